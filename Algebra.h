@@ -24,8 +24,14 @@
 #include <cassert>
 #include <iostream>
 #include <stdexcept>
-#include <vector>
 #include <cmath>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 //--------------------------------------------------------------------
 class algebra_error: public std::logic_error
@@ -36,9 +42,84 @@ class algebra_error: public std::logic_error
     {}
 };
 
+//--------------------------------------------------------------------
+// Storage alignment helper: vectors whose size is a power of two up to
+// 16 bytes are aligned to their size (so a Vector4f fits a SSE register),
+// the rest keep the natural alignment of T to stay tightly packed.
+template<class T, unsigned int N> struct Storage
+{
+    static constexpr unsigned int bytes     = sizeof(T) * N;
+    static constexpr bool         power2    = (bytes & (bytes - 1)) == 0;
+    static constexpr unsigned int alignment = (power2 && bytes <= 16 && bytes > alignof(T)) ? bytes : alignof(T);
+};
+
+//--------------------------------------------------------------------
+// Vector expression base class. Arithmetic on vectors builds a tree of
+// expression nodes that is evaluated element by element in a single loop
+// when assigned to a Vector, so chained operations create no intermediates.
+//
+template<class T, unsigned int N> class Vector;
+
+template<class E, class T, unsigned int N> class VectorExpression
+{
+  public:
+    using value_type = T;
+    static constexpr unsigned int size = N;
+
+    /** \brief Returns the expression as its derived type.
+     *
+     */
+    inline const E &self() const
+    { return static_cast<const E &>(*this); }
+
+    /** \brief Evaluates the expression.
+     *
+     */
+    inline Vector<T, N> eval() const
+    { return Vector<T, N>(*this); }
+
+    /** \brief Returns the norm of the evaluated expression.
+     *
+     */
+    inline double norm() const
+    { return eval().norm(); }
+
+    /** \brief Returns the evaluated expression normalized.
+     *
+     */
+    inline Vector<T, N> normalize() const
+    { return eval().normalize(); }
+
+    /** \brief Returns the evaluated expression augmented with 1 dimension.
+     *
+     */
+    inline Vector<T, N+1> augment(const T value = T(1)) const
+    { return eval().augment(value); }
+
+    /** \brief Returns the evaluated expression projected over the N-1 dimension.
+     *
+     */
+    inline Vector<T, N-1> project(const bool divide = true) const
+    { return eval().project(divide); }
+};
+
+/** \brief True if E is a vector expression.
+ *
+ */
+template<class E> struct IsVectorExpression
+{
+  private:
+    template<class D, class T, unsigned int N> static std::true_type test(const VectorExpression<D, T, N> *);
+    static std::false_type test(...);
+
+  public:
+    static constexpr bool value = decltype(test(std::declval<E *>()))::value;
+};
+
 //--------------------------------------------------------------------
 // Vector class
 template<class T, unsigned int N> class Vector
+: public VectorExpression<Vector<T, N>, T, N>
 {
   public:
     /** \brief Vector class constructor.
@@ -46,10 +127,9 @@ template<class T, unsigned int N> class Vector
      */
     Vector()
     {
-      data.reserve(N);
       for(unsigned int i = 0; i < N; ++i)
       {
-        data.push_back(T(0));
+        data[i] = T(0);
       }
     }
 
@@ -57,14 +137,7 @@ template<class T, unsigned int N> class Vector
      * \param[in] v vector.
      *
      */
-    Vector(const Vector<T, N> &v)
-    {
-      data.reserve(N);
-      for(unsigned int i = 0; i < N; ++i)
-      {
-        data.push_back(v[i]);
-      }
-    }
+    Vector(const Vector<T, N> &v) = default;
 
     /** \brief Vector value constructor.
      * \param[in] value T value.
@@ -72,10 +145,9 @@ template<class T, unsigned int N> class Vector
      */
     Vector(const T &value)
     {
-      data.reserve(N);
       for(unsigned int i = 0; i < N; ++i)
       {
-        data.push_back(value);
+        data[i] = value;
       }
     }
 
@@ -86,7 +158,24 @@ template<class T, unsigned int N> class Vector
     template<class P> Vector(std::initializer_list<P> list)
     {
       assert(list.size() == N);
-      data = std::vector<T>(begin(list), end(list));
+
+      unsigned int i = 0;
+      for(auto value: list)
+      {
+        data[i++] = static_cast<T>(value);
+      }
+    }
+
+    /** \brief Vector expression constructor, evaluates the expression.
+     * \param[in] e vector expression.
+     *
+     */
+    template<class E> Vector(const VectorExpression<E, T, N> &e)
+    {
+      for(unsigned int i = 0; i < N; ++i)
+      {
+        data[i] = e.self()[i];
+      }
     }
 
     /** \brief Scalar assignment operator.
@@ -107,11 +196,17 @@ template<class T, unsigned int N> class Vector
      * \param[in] v vector.
      *
      */
-    Vector<T, N>& operator=(const Vector<T, N> &v)
+    Vector<T, N>& operator=(const Vector<T, N> &v) = default;
+
+    /** \brief Vector expression assignment operator, evaluates the expression.
+     * \param[in] e vector expression.
+     *
+     */
+    template<class E> Vector<T, N>& operator=(const VectorExpression<E, T, N> &e)
     {
       for(unsigned int i = 0; i < N; ++i)
       {
-        data[i] = v[i];
+        data[i] = e.self()[i];
       }
 
       return *this;
@@ -267,49 +362,177 @@ template<class T, unsigned int N> class Vector
     }
 
   private:
-    std::vector<T> data;
+    alignas(Storage<T, N>::alignment) T data[N]; /** inline components, no heap allocation. */
 };
 
+#ifdef __SSE__
+/** \brief Horizontal sum of the four lanes of a SSE register.
+ * \param[in] v register.
+ *
+ */
+inline float hsum_ps(const __m128 v)
+{
+  const auto shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+  const auto sums = _mm_add_ps(v, shuf);
+
+  return _mm_cvtss_f32(_mm_add_ss(sums, _mm_movehl_ps(shuf, sums)));
+}
+
+/** \brief Normalizes the vector, SSE version for Vector4f.
+ *
+ */
+template<> inline Vector<float, 4>& Vector<float, 4>::normalize()
+{
+  const auto v   = _mm_load_ps(data);
+  const auto inv = _mm_set1_ps(1.f / std::sqrt(hsum_ps(_mm_mul_ps(v, v))));
+
+  _mm_store_ps(data, _mm_mul_ps(v, inv));
+
+  return *this;
+}
+#endif // __SSE__
+
 /** \brief operator<<
  * \param[in] stream iostream.
  * \param[in] a vector.
  *
  */
-template<class T, unsigned int N> std::ostream& operator<<(std::ostream &stream, const Vector<T, N> &v)
+template<class E, class T, unsigned int N> std::ostream& operator<<(std::ostream &stream, const VectorExpression<E, T, N> &v)
 {
   stream << "[";
   for(unsigned int i = 0; i < N; ++i)
   {
-    stream << v[i] << ((i == N-1) ? "]" : ",");
+    stream << v.self()[i] << ((i == N-1) ? "]" : ",");
   }
 
   return stream;
 }
 
-/** \brief operator* (scalar*vector)
- * \param[in] c T value.
- * \param[in] a vector.
+//--------------------------------------------------------------------
+// Expression nodes. Operands that are named vectors are referenced, temporaries
+// and nested expressions are stored by value so an expression captured with
+// 'auto' never dangles.
+//
+template<class A> struct ExpressionOperand
+{ using type = typename std::decay<A>::type; };
+
+template<class T, unsigned int N> struct ExpressionOperand<Vector<T, N>&>
+{ using type = const Vector<T, N>&; };
+
+template<class T, unsigned int N> struct ExpressionOperand<const Vector<T, N>&>
+{ using type = const Vector<T, N>&; };
+
+/** \brief Element-wise sum of two vector expressions.
+ *
  */
-template<class T, unsigned int N> inline Vector<T, N> operator*(const T &c, const Vector<T, N> &v)
+template<class L, class R> class VectorSum
+: public VectorExpression<VectorSum<L, R>, typename std::decay<L>::type::value_type, std::decay<L>::type::size>
 {
-  Vector<T, N> tmp(0);
+  public:
+    VectorSum(L l, R r)
+    : m_l(l), m_r(r)
+    {}
 
-  for(unsigned int i = 0; i < N; ++i)
-  {
-    tmp[i] = v[i] * c;
-  }
+    inline typename std::decay<L>::type::value_type operator[](unsigned int i) const
+    { return m_l[i] + m_r[i]; }
 
-  return tmp;
-}
+  private:
+    L m_l; /** left operand.  */
+    R m_r; /** right operand. */
+};
 
-/** \brief operator* (vector*value)
- * \param[in] v vector.
- * \param[in] c T value.
+/** \brief Element-wise difference of two vector expressions.
  *
  */
-template<class T, unsigned int N> inline Vector<T, N> operator*(const Vector<T, N> &v, const T &c)
+template<class L, class R> class VectorDifference
+: public VectorExpression<VectorDifference<L, R>, typename std::decay<L>::type::value_type, std::decay<L>::type::size>
 {
-  return c * v;
+  public:
+    VectorDifference(L l, R r)
+    : m_l(l), m_r(r)
+    {}
+
+    inline typename std::decay<L>::type::value_type operator[](unsigned int i) const
+    { return m_l[i] - m_r[i]; }
+
+  private:
+    L m_l; /** left operand.  */
+    R m_r; /** right operand. */
+};
+
+/** \brief Vector expression multiplied by a scalar. The scalar keeps its own type
+ *  and only the resulting element is converted to the vector type.
+ *
+ */
+template<class L, class S> class VectorScaled
+: public VectorExpression<VectorScaled<L, S>, typename std::decay<L>::type::value_type, std::decay<L>::type::size>
+{
+  public:
+    using T = typename std::decay<L>::type::value_type;
+
+    VectorScaled(L l, const S c)
+    : m_l(l), m_c(c)
+    {}
+
+    inline T operator[](unsigned int i) const
+    { return static_cast<T>(m_l[i] * m_c); }
+
+  private:
+    L       m_l; /** vector operand. */
+    const S m_c; /** scalar operand. */
+};
+
+/** \brief Vector expression divided by a scalar. The scalar keeps its own type
+ *  and only the resulting element is converted to the vector type.
+ *
+ */
+template<class L, class S> class VectorDivided
+: public VectorExpression<VectorDivided<L, S>, typename std::decay<L>::type::value_type, std::decay<L>::type::size>
+{
+  public:
+    using T = typename std::decay<L>::type::value_type;
+
+    VectorDivided(L l, const S c)
+    : m_l(l), m_c(c)
+    {}
+
+    inline T operator[](unsigned int i) const
+    { return static_cast<T>(m_l[i] / m_c); }
+
+  private:
+    L       m_l; /** vector operand. */
+    const S m_c; /** scalar operand. */
+};
+
+/** \brief True if both types are vector expressions of the same type and dimension.
+ *
+ */
+template<class A, class B> struct AreCompatibleExpressions
+{
+    using DA = typename std::decay<A>::type;
+    using DB = typename std::decay<B>::type;
+
+    template<class D, bool> struct Check: std::false_type {};
+    template<class D> struct Check<D, true>
+    : std::integral_constant<bool, std::is_same<typename DA::value_type, typename D::value_type>::value && (DA::size == D::size)> {};
+
+    static constexpr bool value = IsVectorExpression<DA>::value && Check<DB, IsVectorExpression<DA>::value && IsVectorExpression<DB>::value>::value;
+};
+
+/** \brief True if A is a vector expression and X an arithmetic type.
+ *
+ */
+template<class A, class X> struct IsScalarOperation
+: std::integral_constant<bool, IsVectorExpression<typename std::decay<A>::type>::value && std::is_arithmetic<X>::value>
+{};
+
+/** \brief operator* (scalar*vector)
+ * \param[in] c X value.
+ * \param[in] v vector.
+ */
+template<class X, class A> inline typename std::enable_if<IsScalarOperation<A, X>::value, VectorScaled<typename ExpressionOperand<A&&>::type, X>>::type operator*(const X &c, A &&v)
+{
+  return VectorScaled<typename ExpressionOperand<A&&>::type, X>(std::forward<A>(v), c);
 }
 
 /** \brief operator* (vector*value)
@@ -317,31 +540,24 @@ template<class T, unsigned int N> inline Vector<T, N> operator*(const Vector<T,
  * \param[in] c X value.
  *
  */
-template<class T, unsigned int N, class X> inline Vector<T, N> operator*(const Vector<T, N> &v, const X &c)
+template<class A, class X> inline typename std::enable_if<IsScalarOperation<A, X>::value, VectorScaled<typename ExpressionOperand<A&&>::type, X>>::type operator*(A &&v, const X &c)
 {
-  return T(c) * v;
+  return c * std::forward<A>(v);
 }
 
 /** \brief operator/ (vector/value)
  * \param[in] v vector.
- * \param[in] c T value.
+ * \param[in] c X value.
  *
  */
-template<class T, unsigned int N, class X> inline Vector<T, N> operator/(const Vector<T, N> &v, const X &c)
+template<class A, class X> inline typename std::enable_if<IsScalarOperation<A, X>::value, VectorDivided<typename ExpressionOperand<A&&>::type, X>>::type operator/(A &&v, const X &c)
 {
-  if (c == T(0))
+  if (c == X(0))
   {
     throw algebra_error("Vector::operator/: division by zero");
   }
 
-  Vector<T, N> tmp(0);
-
-  for(unsigned int i = 0; i < N; ++i)
-  {
-    tmp[i] = v[i] / static_cast<T>(c);
-  }
-
-  return tmp;
+  return VectorDivided<typename ExpressionOperand<A&&>::type, X>(std::forward<A>(v), c);
 }
 
 /** \brief operator+ (binary)
@@ -349,16 +565,9 @@ template<class T, unsigned int N, class X> inline Vector<T, N> operator/(const V
  * \param[in] b vector.
  *
  */
-template<class T, unsigned int N> inline Vector<T, N> operator+(const Vector<T, N> &a, const Vector<T, N> &b)
+template<class A, class B> inline typename std::enable_if<AreCompatibleExpressions<A, B>::value, VectorSum<typename ExpressionOperand<A&&>::type, typename ExpressionOperand<B&&>::type>>::type operator+(A &&a, B &&b)
 {
-  Vector<T, N> result(0);
-
-  for(unsigned int i = 0; i < N; ++i)
-  {
-    result[i] = a[i] + b[i];
-  }
-
-  return result;
+  return VectorSum<typename ExpressionOperand<A&&>::type, typename ExpressionOperand<B&&>::type>(std::forward<A>(a), std::forward<B>(b));
 }
 
 /** \brief operator- (binary)
@@ -366,16 +575,9 @@ template<class T, unsigned int N> inline Vector<T, N> operator+(const Vector<T,
  * \param[in] b vector.
  *
  */
-template<class T, unsigned int N> inline Vector<T, N> operator-(const Vector<T, N> &a, const Vector<T, N> &b)
+template<class A, class B> inline typename std::enable_if<AreCompatibleExpressions<A, B>::value, VectorDifference<typename ExpressionOperand<A&&>::type, typename ExpressionOperand<B&&>::type>>::type operator-(A &&a, B &&b)
 {
-  Vector<T, N> result(0);
-
-  for(unsigned int i = 0; i < N; ++i)
-  {
-    result[i] = a[i] - b[i];
-  }
-
-  return result;
+  return VectorDifference<typename ExpressionOperand<A&&>::type, typename ExpressionOperand<B&&>::type>(std::forward<A>(a), std::forward<B>(b));
 }
 
 /** \brief operator* (binary, dot product)
@@ -383,13 +585,13 @@ template<class T, unsigned int N> inline Vector<T, N> operator-(const Vector<T,
  * \param[in] b vector.
  *
  */
-template<class T, unsigned int N> inline T operator*(const Vector<T, N> &a, const Vector<T, N> &b)
+template<class EA, class EB, class T, unsigned int N> inline T operator*(const VectorExpression<EA, T, N> &a, const VectorExpression<EB, T, N> &b)
 {
   T sum = 0;
 
   for(unsigned int i = 0; i < N; ++i)
   {
-    sum += a[i] * b[i];
+    sum += a.self()[i] * b.self()[i];
   }
 
   return sum;
@@ -400,11 +602,11 @@ template<class T, unsigned int N> inline T operator*(const Vector<T, N> &a, cons
  * \param[in] b vector.
  *
  */
-template<class T, unsigned int N> inline Vector<T, N> operator+=(Vector<T, N> &a, const Vector<T, N> &b)
+template<class T, unsigned int N, class E> inline Vector<T, N>& operator+=(Vector<T, N> &a, const VectorExpression<E, T, N> &b)
 {
   for(unsigned int i = 0; i < N; ++i)
   {
-    a[i] = a[i] + b[i];
+    a[i] += b.self()[i];
   }
 
   return a;
@@ -415,42 +617,33 @@ template<class T, unsigned int N> inline Vector<T, N> operator+=(Vector<T, N> &a
  * \param[in] b vector.
  *
  */
-template<class T, unsigned int N> inline Vector<T, N> operator-=(Vector<T, N> &a, const Vector<T, N> &b)
+template<class T, unsigned int N, class E> inline Vector<T, N>& operator-=(Vector<T, N> &a, const VectorExpression<E, T, N> &b)
 {
   for(unsigned int i = 0; i < N; ++i)
   {
-    a[i] = a[i] - b[i];
+    a[i] -= b.self()[i];
   }
 
   return a;
 }
 
 /** \brief operator*= (vector*value)
- * \param[in] a vector.
+ * \param[in] v vector.
  * \param[in] c X value.
  *
  */
-template<class T, unsigned int N> inline Vector<T, N> operator*=(const Vector<T, N> &v, const T &c)
+template<class T, unsigned int N, class X> inline Vector<T, N>& operator*=(Vector<T, N> &v, const X &c)
 {
   for(unsigned int i = 0; i < N; ++i)
   {
-    v[i] = v[i] * c;
+    v[i] = static_cast<T>(v[i] * c);
   }
-}
 
-/** \brief operator*= (vector*value)
- * \param[in] a vector.
- * \param[in] c X value.
- *
- */
-template<class T, unsigned int N, class X> inline Vector<T, N> operator*=(const Vector<T, N> &v, const X &c)
-{
-  for(unsigned int i = 0; i < N; ++i)
-  {
-    v[i] = v[i] * static_cast<T>(c);
-  }
+  return v;
 }
 
+template<class T, unsigned int N> struct SquareMatrix;
+
 //--------------------------------------------------------------------
 // Matrix class
 //
@@ -469,14 +662,7 @@ template<class T, unsigned int R, unsigned int C> class Matrix
      * \param[in] a matrix.
      *
      */
-    Matrix(const Matrix<T, R, C> &a)
-    {
-      data.reserve(R);
-      for(unsigned int i = 0; i < R; ++i)
-      {
-        data.push_back(a[i]);
-      }
-    }
+    Matrix(const Matrix<T, R, C> &a) = default;
 
     /** \brief Matrix3 constructor with a scalar.
      * \param[in] value scalar value.
@@ -484,11 +670,11 @@ template<class T, unsigned int R, unsigned int C> class Matrix
      */
     Matrix(const T& scalar)
     {
-      auto m_row = Vector<T,C>(scalar);
+      const auto m_row = Vector<T,C>(scalar);
 
       for(unsigned int i = 0; i < R; ++i)
       {
-        data.push_back(m_row);
+        data[i] = m_row;
       }
     }
 
@@ -511,15 +697,7 @@ template<class T, unsigned int R, unsigned int C> class Matrix
      * \param[in] a matrix.
      *
      */
-    Matrix<T, R, C>& operator=(const Matrix<T, R, C> &a)
-    {
-      for(unsigned int i = 0; i < R; ++i)
-      {
-        data[i] = a[i];
-      }
-
-      return *this;
-    }
+    Matrix<T, R, C>& operator=(const Matrix<T, R, C> &a) = default;
 
     /** \brief Operator =(matrix)
      * \param[in] a matrix.
@@ -707,80 +885,15 @@ template<class T, unsigned int R, unsigned int C> class Matrix
       return result;
     }
 
-    /** \brief Inverse operation.
+    /** \brief Inverse operation. Closed form for 2x2, 3x3 and 4x4 matrices and
+     *  Gauss-Jordan elimination with partial pivoting for the rest.
      *
      */
     Matrix<T, R, C> inverse() const
     {
-      assert(R == C);
-
-      // augmenting the square matrix with the identity matrix of the same dimensions.
-      std::vector<Vector<T, 2*C>> result;
-      result.reserve(R);
-      for (unsigned int i = 0; i < R; i++)
-      {
-        result.push_back(Vector<T,2*C>(0));
-      }
+      static_assert(R == C, "Matrix::inverse: matrix must be square");
 
-      for (unsigned int i = 0; i < R; i++)
-      {
-        result[i][i+C] = 1;
-
-        for (unsigned int j = 0; j < C; j++)
-        {
-          result[i][j]   = data[i][j];
-        }
-      }
-
-      // first pass
-      for (unsigned int i = 0; i < R-1; i++)
-      {
-        // normalize the first row
-        for (int j = (2*C)-1; j >= 0; j--)
-        {
-          result[i][j] /= result[i][i];
-        }
-
-        for (unsigned int k = i + 1; k < R; k++)
-        {
-          float coeff = result[k][i];
-          for (unsigned int j = 0; j < 2*C; j++)
-          {
-            result[k][j] -= result[i][j] * coeff;
-          }
-        }
-      }
-
-      // normalize the last row
-      for (unsigned int j = (2*C) - 1; j >= C-1; j--)
-      {
-        result[R-1][j] /= result[R-1][R-1];
-      }
-
-      // second pass
-      for (int i = R-1; i > 0; i--)
-      {
-        for (int k = i - 1; k >= 0; k--)
-        {
-          float coeff = result[k][i];
-          for (unsigned int j = 0; j < 2*C; j++)
-          {
-            result[k][j] -= result[i][j] * coeff;
-          }
-        }
-      }
-
-      // cut the identity matrix back
-      Matrix<T, R, C> truncate;
-      for (unsigned int i = 0; i < R; i++)
-      {
-        for (unsigned int j = 0; j < C; j++)
-        {
-          truncate[i][j] = result[i][j + C];
-        }
-      }
-
-      return truncate;
+      return SquareMatrix<T, R>::inverse(*this);
     }
 
     /** \brief Returns the sub-matrix of the position (i,j)
@@ -810,24 +923,15 @@ template<class T, unsigned int R, unsigned int C> class Matrix
       return result;
     }
 
-    /** \brief Determinant operator.
+    /** \brief Determinant operator. Closed form for 2x2, 3x3 and 4x4 matrices and
+     *  Gaussian elimination with partial pivoting for the rest.
      *
      */
-    float determinant() const
+    T determinant() const
     {
-      assert(R = C);
-
-      if(R == 2) return (data[0][0]*data[1][1]) - (data[0][1]*data[1][0]);
-
-      float result{0};
-      auto sign = [](unsigned int i) { return (i % 2) ? -1 : 1; };
+      static_assert(R == C, "Matrix::determinant: matrix must be square");
 
-      for(unsigned int i = 0; i < C; ++i)
-      {
-        result += sign(i) * data[0,i] * sub(0,i).determinant();
-      }
-
-      return result;
+      return SquareMatrix<T, R>::determinant(*this);
     }
 
     /** \brief Identity operator.
@@ -875,7 +979,236 @@ template<class T, unsigned int R, unsigned int C> class Matrix
     }
 
   private:
-    std::vector<Vector<T, C>> data;
+    Vector<T, C> data[R]; /** matrix rows, stored inline. */
+};
+
+//--------------------------------------------------------------------
+// Square matrix operations, dispatched on the size at compile time.
+//
+template<class T, unsigned int N> struct SquareMatrix
+{
+    /** \brief Returns the determinant of the given matrix.
+     * \param[in] m matrix.
+     *
+     */
+    static T determinant(const Matrix<T, N, N> &m)
+    {
+      auto a = m;
+      T result = T(1);
+
+      for(unsigned int i = 0; i < N; ++i)
+      {
+        const auto pivot = SquareMatrix<T, N>::pivot(a, i);
+        if(a[pivot][i] == T(0)) return T(0);
+
+        if(pivot != i)
+        {
+          std::swap(a[pivot], a[i]);
+          result = -result;
+        }
+
+        result *= a[i][i];
+
+        for(unsigned int k = i + 1; k < N; ++k)
+        {
+          const T coeff = a[k][i] / a[i][i];
+          for(unsigned int j = i; j < N; ++j)
+          {
+            a[k][j] -= a[i][j] * coeff;
+          }
+        }
+      }
+
+      return result;
+    }
+
+    /** \brief Returns the inverse of the given matrix.
+     * \param[in] m matrix.
+     *
+     */
+    static Matrix<T, N, N> inverse(const Matrix<T, N, N> &m)
+    {
+      auto a = m;
+      Matrix<T, N, N> result;
+      result.identity();
+
+      for(unsigned int i = 0; i < N; ++i)
+      {
+        const auto pivot = SquareMatrix<T, N>::pivot(a, i);
+        if(pivot != i)
+        {
+          std::swap(a[pivot], a[i]);
+          std::swap(result[pivot], result[i]);
+        }
+
+        const T inv = T(1) / a[i][i];
+        for(unsigned int j = 0; j < N; ++j)
+        {
+          a[i][j] *= inv;
+          result[i][j] *= inv;
+        }
+
+        for(unsigned int k = 0; k < N; ++k)
+        {
+          if(k == i) continue;
+
+          const T coeff = a[k][i];
+          for(unsigned int j = 0; j < N; ++j)
+          {
+            a[k][j] -= a[i][j] * coeff;
+            result[k][j] -= result[i][j] * coeff;
+          }
+        }
+      }
+
+      return result;
+    }
+
+  private:
+    /** \brief Returns the row with the biggest absolute value in the column i, from row i downwards.
+     * \param[in] a matrix.
+     * \param[in] i column index.
+     *
+     */
+    static unsigned int pivot(const Matrix<T, N, N> &a, const unsigned int i)
+    {
+      unsigned int result = i;
+      for(unsigned int k = i + 1; k < N; ++k)
+      {
+        if(std::abs(a[k][i]) > std::abs(a[result][i])) result = k;
+      }
+
+      return result;
+    }
+};
+
+template<class T> struct SquareMatrix<T, 2>
+{
+    static T determinant(const Matrix<T, 2, 2> &m)
+    {
+      return m[0][0]*m[1][1] - m[0][1]*m[1][0];
+    }
+
+    static Matrix<T, 2, 2> inverse(const Matrix<T, 2, 2> &m)
+    {
+      const T inv = T(1) / determinant(m);
+
+      Matrix<T, 2, 2> result;
+      result[0][0] =  m[1][1] * inv; result[0][1] = -m[0][1] * inv;
+      result[1][0] = -m[1][0] * inv; result[1][1] =  m[0][0] * inv;
+
+      return result;
+    }
+};
+
+template<class T> struct SquareMatrix<T, 3>
+{
+    static T determinant(const Matrix<T, 3, 3> &m)
+    {
+      return m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+           + m[0][1] * (m[1][2]*m[2][0] - m[1][0]*m[2][2])
+           + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+    }
+
+    /** \brief Inverse as the adjugate divided by the determinant.
+     * \param[in] m matrix.
+     *
+     */
+    static Matrix<T, 3, 3> inverse(const Matrix<T, 3, 3> &m)
+    {
+      Matrix<T, 3, 3> result;
+      result[0][0] = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+      result[0][1] = m[0][2]*m[2][1] - m[0][1]*m[2][2];
+      result[0][2] = m[0][1]*m[1][2] - m[0][2]*m[1][1];
+      result[1][0] = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+      result[1][1] = m[0][0]*m[2][2] - m[0][2]*m[2][0];
+      result[1][2] = m[0][2]*m[1][0] - m[0][0]*m[1][2];
+      result[2][0] = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+      result[2][1] = m[0][1]*m[2][0] - m[0][0]*m[2][1];
+      result[2][2] = m[0][0]*m[1][1] - m[0][1]*m[1][0];
+
+      const T inv = T(1) / (m[0][0]*result[0][0] + m[0][1]*result[1][0] + m[0][2]*result[2][0]);
+      for(unsigned int i = 0; i < 3; ++i)
+      {
+        for(unsigned int j = 0; j < 3; ++j)
+        {
+          result[i][j] *= inv;
+        }
+      }
+
+      return result;
+    }
+};
+
+template<class T> struct SquareMatrix<T, 4>
+{
+    static T determinant(const Matrix<T, 4, 4> &m)
+    {
+      T s[6], c[6];
+      minors(m, s, c);
+
+      return s[0]*c[5] - s[1]*c[4] + s[2]*c[3] + s[3]*c[2] - s[4]*c[1] + s[5]*c[0];
+    }
+
+    /** \brief Inverse as the adjugate divided by the determinant, using the 2x2
+     *  minors of the upper and lower halves of the matrix.
+     * \param[in] m matrix.
+     *
+     */
+    static Matrix<T, 4, 4> inverse(const Matrix<T, 4, 4> &m)
+    {
+      T s[6], c[6];
+      minors(m, s, c);
+
+      const T inv = T(1) / (s[0]*c[5] - s[1]*c[4] + s[2]*c[3] + s[3]*c[2] - s[4]*c[1] + s[5]*c[0]);
+
+      Matrix<T, 4, 4> result;
+      result[0][0] = ( m[1][1]*c[5] - m[1][2]*c[4] + m[1][3]*c[3]) * inv;
+      result[0][1] = (-m[0][1]*c[5] + m[0][2]*c[4] - m[0][3]*c[3]) * inv;
+      result[0][2] = ( m[3][1]*s[5] - m[3][2]*s[4] + m[3][3]*s[3]) * inv;
+      result[0][3] = (-m[2][1]*s[5] + m[2][2]*s[4] - m[2][3]*s[3]) * inv;
+
+      result[1][0] = (-m[1][0]*c[5] + m[1][2]*c[2] - m[1][3]*c[1]) * inv;
+      result[1][1] = ( m[0][0]*c[5] - m[0][2]*c[2] + m[0][3]*c[1]) * inv;
+      result[1][2] = (-m[3][0]*s[5] + m[3][2]*s[2] - m[3][3]*s[1]) * inv;
+      result[1][3] = ( m[2][0]*s[5] - m[2][2]*s[2] + m[2][3]*s[1]) * inv;
+
+      result[2][0] = ( m[1][0]*c[4] - m[1][1]*c[2] + m[1][3]*c[0]) * inv;
+      result[2][1] = (-m[0][0]*c[4] + m[0][1]*c[2] - m[0][3]*c[0]) * inv;
+      result[2][2] = ( m[3][0]*s[4] - m[3][1]*s[2] + m[3][3]*s[0]) * inv;
+      result[2][3] = (-m[2][0]*s[4] + m[2][1]*s[2] - m[2][3]*s[0]) * inv;
+
+      result[3][0] = (-m[1][0]*c[3] + m[1][1]*c[1] - m[1][2]*c[0]) * inv;
+      result[3][1] = ( m[0][0]*c[3] - m[0][1]*c[1] + m[0][2]*c[0]) * inv;
+      result[3][2] = (-m[3][0]*s[3] + m[3][1]*s[1] - m[3][2]*s[0]) * inv;
+      result[3][3] = ( m[2][0]*s[3] - m[2][1]*s[1] + m[2][2]*s[0]) * inv;
+
+      return result;
+    }
+
+  private:
+    /** \brief Computes the 2x2 minors of the two upper rows (s) and the two lower rows (c).
+     * \param[in] m matrix.
+     * \param[out] s upper minors.
+     * \param[out] c lower minors.
+     *
+     */
+    static void minors(const Matrix<T, 4, 4> &m, T *s, T *c)
+    {
+      s[0] = m[0][0]*m[1][1] - m[1][0]*m[0][1];
+      s[1] = m[0][0]*m[1][2] - m[1][0]*m[0][2];
+      s[2] = m[0][0]*m[1][3] - m[1][0]*m[0][3];
+      s[3] = m[0][1]*m[1][2] - m[1][1]*m[0][2];
+      s[4] = m[0][1]*m[1][3] - m[1][1]*m[0][3];
+      s[5] = m[0][2]*m[1][3] - m[1][2]*m[0][3];
+
+      c[0] = m[2][0]*m[3][1] - m[3][0]*m[2][1];
+      c[1] = m[2][0]*m[3][2] - m[3][0]*m[2][2];
+      c[2] = m[2][0]*m[3][3] - m[3][0]*m[2][3];
+      c[3] = m[2][1]*m[3][2] - m[3][1]*m[2][2];
+      c[4] = m[2][1]*m[3][3] - m[3][1]*m[2][3];
+      c[5] = m[2][2]*m[3][3] - m[3][2]*m[2][3];
+    }
 };
 
 /** \brief operator <<
@@ -1069,6 +1402,74 @@ template<class T> inline Vector<T,3> operator^ (const Vector<T,3> &v, const Vect
   return result;
 }
 
+//--------------------------------------------------------------------
+// Special cases: 4-wide float kernels. Selected at compile time when SSE is
+// available (always on x86-64), otherwise the generic templates are used.
+// AVX is not used here as translation units are built with different flags.
+//
+#ifdef __SSE__
+/** \brief operator* (binary, dot product) SSE version for Vector4f.
+ * \param[in] a vector.
+ * \param[in] b vector.
+ *
+ */
+inline float operator*(const Vector<float, 4> &a, const Vector<float, 4> &b)
+{
+  return hsum_ps(_mm_mul_ps(_mm_load_ps(&a[0]), _mm_load_ps(&b[0])));
+}
+
+/** \brief operator* (binary, vector) SSE version for Matrix4f * Vector4f.
+ * \param[in] m matrix.
+ * \param[in] v vector.
+ *
+ */
+inline Vector<float, 4> operator*(const Matrix<float, 4, 4> &m, const Vector<float, 4> &v)
+{
+  const auto x = _mm_load_ps(&v[0]);
+
+  auto r0 = _mm_mul_ps(_mm_load_ps(&m[0][0]), x);
+  auto r1 = _mm_mul_ps(_mm_load_ps(&m[1][0]), x);
+  auto r2 = _mm_mul_ps(_mm_load_ps(&m[2][0]), x);
+  auto r3 = _mm_mul_ps(_mm_load_ps(&m[3][0]), x);
+
+  // lane i of the sum is the dot product of row i.
+  _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+  Vector<float, 4> result;
+  _mm_store_ps(&result[0], _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3)));
+
+  return result;
+}
+
+/** \brief operator* (binary, matrix) SSE version for Matrix4f * Matrix4f.
+ * \param[in] m matrix.
+ * \param[in] n matrix.
+ *
+ */
+inline Matrix<float, 4, 4> operator*(const Matrix<float, 4, 4> &m, const Matrix<float, 4, 4> &n)
+{
+  const __m128 rows[4] = { _mm_load_ps(&n[0][0]), _mm_load_ps(&n[1][0]), _mm_load_ps(&n[2][0]), _mm_load_ps(&n[3][0]) };
+
+  Matrix<float, 4, 4> result;
+  for(unsigned int i = 0; i < 4; ++i)
+  {
+    // row i of the result is the combination of the rows of n weighted by row i of m.
+    auto sum = _mm_mul_ps(_mm_set1_ps(m[i][0]), rows[0]);
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(m[i][1]), rows[1]));
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(m[i][2]), rows[2]));
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(m[i][3]), rows[3]));
+
+    _mm_store_ps(&result[i][0], sum);
+  }
+
+  return result;
+}
+#endif // __SSE__
+
+static_assert(std::is_trivially_copyable<Vector<float, 4>>::value, "Vector must be trivially copyable");
+static_assert(sizeof(Vector<float, 3>) == 3 * sizeof(float), "Vector must be stored inline");
+static_assert(sizeof(Matrix<float, 4, 4>) == 16 * sizeof(float), "Matrix must be stored inline");
+
 using Vector2ui  = Vector<unsigned int, 2>;
 using Vector2i   = Vector<int, 2>;
 using Vector2f   = Vector<float, 2>;
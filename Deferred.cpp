@@ -0,0 +1,172 @@
+/*
+ File: Deferred.cpp
+ Created on: 16 oct. 2026
+ Author: Felix de las Pozas Alvarez
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Project
+#include <Deferred.h>
+#include <Mesh.h>
+
+// C++
+#include <chrono>
+#include <iostream>
+
+using namespace Images;
+using namespace Utils;
+
+//--------------------------------------------------------------------
+Deferred::GBuffer::GBuffer(const short width, const short height)
+: width   {width}
+, height  {height}
+, mesh    (width*height)
+, uv      (width*height)
+, normal  (width*height)
+, position(width*height)
+, shadow  (width*height)
+{
+  clear();
+}
+
+//--------------------------------------------------------------------
+void Deferred::GBuffer::clear()
+{
+  std::fill(mesh.begin(), mesh.end(), VisibilityBuffer::EMPTY);
+  std::fill(shadow.begin(), shadow.end(), 1.f);
+}
+
+//--------------------------------------------------------------------
+void Deferred::geometry(const std::vector<std::shared_ptr<Mesh>> &meshes, const FinalShaderFactory &factory, const VisibilityBuffer &visibility, GBuffer &gbuffer)
+{
+  const auto start = std::chrono::high_resolution_clock::now();
+
+  unsigned long pixels = 0;
+
+  #pragma omp parallel reduction(+:pixels)
+  {
+    auto shader = factory();
+    auto mesh   = VisibilityBuffer::EMPTY;
+    unsigned long face = 0;
+    Vector3f vertices[3];
+
+    #pragma omp for schedule(dynamic,1)
+    for (int y = 0; y < gbuffer.height; ++y)
+    {
+      for (int x = 0; x < gbuffer.width; ++x)
+      {
+        const auto i = y * gbuffer.width + x;
+        const auto &sample = visibility.get(x, y);
+
+        gbuffer.mesh[i] = VisibilityBuffer::EMPTY;
+        if(sample.mesh == VisibilityBuffer::EMPTY) continue;
+
+        if(sample.mesh != mesh || sample.face != face)
+        {
+          shader->setMesh(meshes[sample.mesh].get());
+
+          mesh = sample.mesh;
+          face = sample.face;
+
+          const auto ids = shader->mesh()->getFaceVertexIds(face);
+          for (int j = 0; j < 3; j++)
+          {
+            shader->vertex(face, j);
+            vertices[j] = shader->mesh()->getVertex(ids[j]);
+          }
+          shader->setup();
+        }
+
+        const Vector3f bc{1.f - sample.barycentric[0] - sample.barycentric[1], sample.barycentric[0], sample.barycentric[1]};
+
+        Vector2f uv;
+        Vector3f n;
+        if(!shader->surface(bc, uv, n)) continue;
+
+        gbuffer.mesh[i]     = mesh;
+        gbuffer.uv[i]       = uv;
+        gbuffer.normal[i]   = n;
+        gbuffer.position[i] = vertices[0] * bc[0] + vertices[1] * bc[1] + vertices[2] * bc[2];
+        ++pixels;
+      }
+    }
+  }
+
+  const auto end = std::chrono::high_resolution_clock::now();
+
+  std::cout << "g-buffer pixels: " << pixels << " time: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl << std::flush;
+}
+
+//--------------------------------------------------------------------
+void Deferred::shadows(const FinalShaderFactory &factory, GBuffer &gbuffer)
+{
+  const auto start = std::chrono::high_resolution_clock::now();
+
+  // the shader is only read.
+  const auto shader    = factory();
+  const auto transform = shader->uniform_transform_S;
+  const int  size      = gbuffer.width * gbuffer.height;
+
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < size; ++i)
+  {
+    if(gbuffer.mesh[i] == VisibilityBuffer::EMPTY) continue;
+
+    gbuffer.shadow[i] = shader->shadow((transform * gbuffer.position[i].augment()).project());
+  }
+
+  const auto end = std::chrono::high_resolution_clock::now();
+
+  std::cout << "shadows time: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl << std::flush;
+}
+
+//--------------------------------------------------------------------
+void Deferred::lighting(const std::vector<std::shared_ptr<Mesh>> &meshes, const FinalShaderFactory &factory, const GBuffer &gbuffer, Images::Image &image)
+{
+  const auto start = std::chrono::high_resolution_clock::now();
+
+  #pragma omp parallel
+  {
+    auto shader = factory();
+    auto mesh   = VisibilityBuffer::EMPTY;
+
+    #pragma omp for schedule(dynamic,1)
+    for (int y = 0; y < gbuffer.height; ++y)
+    {
+      for (int x = 0; x < gbuffer.width; ++x)
+      {
+        const auto i = y * gbuffer.width + x;
+        if(gbuffer.mesh[i] == VisibilityBuffer::EMPTY) continue;
+
+        if(gbuffer.mesh[i] != mesh)
+        {
+          mesh = gbuffer.mesh[i];
+          shader->setMesh(meshes[mesh].get());
+        }
+
+        Color color;
+        bool discard = shader->light(gbuffer.uv[i], gbuffer.normal[i], shader->ambient(x, y), gbuffer.shadow[i], color);
+        if (!discard)
+        {
+          image.set(x, y, color);
+        }
+      }
+    }
+  }
+
+  const auto end = std::chrono::high_resolution_clock::now();
+
+  std::cout << "lighting time: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl << std::flush;
+}
@@ -0,0 +1,97 @@
+/*
+ File: Deferred.h
+ Created on: 16 oct. 2026
+ Author: Felix de las Pozas Alvarez
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEFERRED_H_
+#define DEFERRED_H_
+
+// Project
+#include <Algebra.h>
+#include <Images.h>
+#include <Shaders.h>
+#include <Utils.h>
+
+// C++
+#include <functional>
+#include <memory>
+#include <vector>
+
+class Mesh;
+
+namespace Deferred
+{
+  /** \struct GBuffer
+   * \brief Surface attributes of the visible point of each pixel, stored by attribute.
+   *
+   */
+  struct GBuffer
+  {
+      /** \brief GBuffer class constructor.
+       * \param[in] width buffer width.
+       * \param[in] height buffer height.
+       *
+       */
+      GBuffer(const short width, const short height);
+
+      /** \brief Clears the buffer.
+       *
+       */
+      void clear();
+
+      const short                 width;    /** buffer width.                                                        */
+      const short                 height;   /** buffer height.                                                       */
+      std::vector<unsigned short> mesh;     /** mesh index (material), Utils::VisibilityBuffer::EMPTY if no surface. */
+      std::vector<Vector2f>       uv;       /** texture coordinates.                                                 */
+      std::vector<Vector3f>       normal;   /** surface normal in Projection*ModelView space.                        */
+      std::vector<Vector3f>       position; /** surface point in object space.                                       */
+      std::vector<float>          shadow;   /** shadow coefficient, computed by the shadows pass.                    */
+  };
+
+  /** \brief Returns a new final shader with its uniforms set, called once per rendering thread. */
+  using FinalShaderFactory = std::function<std::unique_ptr<FinalShader>()>;
+
+  /** \brief Fills the G-buffer with the surface attributes of the fragments stored in the visibility buffer.
+   * \param[in] meshes meshes used to fill the visibility buffer.
+   * \param[in] factory shader factory.
+   * \param[in] visibility visibility buffer.
+   * \param[out] gbuffer G-buffer.
+   *
+   */
+  void geometry(const std::vector<std::shared_ptr<Mesh>> &meshes, const FinalShaderFactory &factory, const Utils::VisibilityBuffer &visibility, GBuffer &gbuffer);
+
+  /** \brief Computes the shadow coefficient of every pixel of the G-buffer using the light depth buffer
+   *  and transformation of the shader.
+   * \param[in] factory shader factory.
+   * \param[inout] gbuffer G-buffer.
+   *
+   */
+  void shadows(const FinalShaderFactory &factory, GBuffer &gbuffer);
+
+  /** \brief Computes the color of every pixel of the G-buffer with the diffuse, specular, ambient and glow
+   *  terms of the shader and the shadow coefficients.
+   * \param[in] meshes meshes used to fill the G-buffer.
+   * \param[in] factory shader factory.
+   * \param[in] gbuffer G-buffer.
+   * \param[inout] image image to draw on.
+   *
+   */
+  void lighting(const std::vector<std::shared_ptr<Mesh>> &meshes, const FinalShaderFactory &factory, const GBuffer &gbuffer, Images::Image &image);
+
+} // namespace Deferred
+
+#endif // DEFERRED_H_
@@ -19,12 +19,19 @@
 
 // Project
 #include "GL_Impl.h"
+#include "Mesh.h"
+#include "Shaders.h"
 #include "Utils.h"
 
 // C++
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <iostream>
 #include <limits>
+#include <type_traits>
 #include <intrin.h>
+#include <omp.h>
 
 using namespace Images;
 using namespace Utils;
@@ -103,81 +110,976 @@ void GL_Impl::line(int x0, int y0, int x1, int y1, Image &image, const Color &co
   }
 }
 
+// Sub-pixel precision of the rasterization, the screen coordinates are snapped to 1/SUBPIXEL of a pixel.
+const int       SUBPIXEL_BITS = 8;
+const long long SUBPIXEL      = 1 << SUBPIXEL_BITS;
+
 //--------------------------------------------------------------------
-Vector3f barycentric(Vector2f *pts, const Vector3f &P)
+/** \brief Returns the coordinate in fixed point with SUBPIXEL_BITS fractional bits.
+ * \param[in] value screen coordinate.
+ *
+ */
+inline long long snap(const float value)
 {
-  Vector3f s[2];
+  return std::llround(value * SUBPIXEL);
+}
 
-  for (auto i: {0,1})
+//--------------------------------------------------------------------
+/** \brief Computes the screen coordinates of the triangle and its bounding box clamped to the given rectangle.
+ * \param[in] sPts pointer to augmented triangle points.
+ * \param[out] points triangle points in viewport coordinates.
+ * \param[out] pts triangle points projected on the screen.
+ * \param[in] bmin rectangle minimum pixel coordinates.
+ * \param[in] bmax rectangle maximum pixel coordinates, inclusive.
+ * \param[out] min bounding box minimum, first pixel inside the snapped coordinates.
+ * \param[out] max bounding box maximum, last pixel inside the snapped coordinates.
+ *
+ */
+void screenBounds(const Vector4f *sPts, Matrix<float,3,4> &points, Vector2f *pts, const Vector2i &bmin, const Vector2i &bmax, Vector2i &min, Vector2i &max)
+{
+  for(int i = 0; i < 3; ++i)
   {
-    s[i][0] = pts[2][i] - pts[0][i];
-    s[i][1] = pts[1][i] - pts[0][i];
-    s[i][2] = pts[0][i] - P[i];
+    points[i] = ViewPort*sPts[i];
+    auto point = points[i].project();
+    pts[i][0] = point[0];
+    pts[i][1] = point[1];
   }
 
-  auto u = s[0] ^ s[1];
+  // pixels inside the snapped coordinates of the vertices.
+  for (int j: {0,1})
+  {
+    const auto low  = std::min(snap(pts[0][j]), std::min(snap(pts[1][j]), snap(pts[2][j])));
+    const auto high = std::max(snap(pts[0][j]), std::max(snap(pts[1][j]), snap(pts[2][j])));
+
+    min[j] = std::max<long long>(bmin[j], (low + SUBPIXEL - 1) >> SUBPIXEL_BITS);
+    max[j] = std::min<long long>(bmax[j], high >> SUBPIXEL_BITS);
+  }
+}
 
-  // dont forget that u[2] is integer. If it is zero then triangle ABC is degenerate
-  if (std::abs(u[2]) <= 0)
+// Clipping planes in homogeneous coordinates. The near and far planes bound the w coordinate, which is
+// the distance to the camera in units of the eye to focal point distance. Only the triangles that leave
+// the guard band, GUARD_BAND times the viewport size around its center, are clipped in x and y as the
+// rasterizer handles the rest with its bounding box.
+const float NEAR_PLANE = 0.01f;
+const float FAR_PLANE  = 100.f;
+const float GUARD_BAND = 16.f;
+
+/** Maximum number of vertices of a triangle clipped by the six planes. */
+const unsigned int MAX_CLIPPED = 9;
+
+//--------------------------------------------------------------------
+/** \brief Returns the signed distance of the point to the given clipping plane, negative if outside.
+ * \param[in] point point in homogeneous coordinates.
+ * \param[in] plane plane index.
+ *
+ */
+inline float planeDistance(const Vector4f &point, const unsigned int plane)
+{
+  switch(plane)
   {
-    return Vector3f{-1, 1, 1}; // in this case generate negative coordinates, it will be thrown away by the rasterizator
+    case 0:  return point[3] - NEAR_PLANE;
+    case 1:  return FAR_PLANE - point[3];
+    case 2:  return GUARD_BAND * point[3] + point[0];
+    case 3:  return GUARD_BAND * point[3] - point[0];
+    case 4:  return GUARD_BAND * point[3] + point[1];
+    default: return GUARD_BAND * point[3] - point[1];
+  }
+}
+
+//--------------------------------------------------------------------
+/** \brief Classifies the triangle against the clipping planes. Returns 0 if the triangle is inside all
+ *  the planes, -1 if it's completely outside one of them and 1 if it needs clipping.
+ * \param[in] sPts pointer to augmented triangle points.
+ *
+ */
+int clipTest(const Vector4f *sPts)
+{
+  auto result = 0;
+  for(unsigned int plane = 0; plane < 6; ++plane)
+  {
+    const auto outside = (planeDistance(sPts[0], plane) < 0) + (planeDistance(sPts[1], plane) < 0) + (planeDistance(sPts[2], plane) < 0);
+
+    if(outside == 3) return -1;
+    if(outside != 0) result = 1;
   }
 
-  return Vector3f{1.f - (u[0] + u[1]) / u[2], u[1] / u[2], u[0] / u[2]};
+  return result;
 }
 
 //--------------------------------------------------------------------
-void GL_Impl::triangle(Vector4f *sPts, Shader &shader, zBuffer &buffer, Images::Image &image)
+/** \brief Clips the triangle against the clipping planes (Sutherland-Hodgman) and returns the number of
+ *  vertices of the resulting convex polygon, 0 if nothing remains.
+ * \param[in] sPts pointer to augmented triangle points.
+ * \param[out] points polygon vertices, at least MAX_CLIPPED.
+ * \param[out] barycentric barycentric coordinates of the polygon vertices in the original triangle.
+ *
+ */
+unsigned int clip(const Vector4f *sPts, Vector4f *points, Vector3f *barycentric)
+{
+  Vector4f pIn[MAX_CLIPPED];
+  Vector3f bIn[MAX_CLIPPED];
+  unsigned int size = 3;
+
+  for(int i = 0; i < 3; ++i)
+  {
+    points[i] = sPts[i];
+    barycentric[i] = Vector3f{i == 0 ? 1.f : 0.f, i == 1 ? 1.f : 0.f, i == 2 ? 1.f : 0.f};
+  }
+
+  for(unsigned int plane = 0; plane < 6 && size > 0; ++plane)
+  {
+    std::copy_n(points, size, pIn);
+    std::copy_n(barycentric, size, bIn);
+
+    const auto count = size;
+    size = 0;
+
+    for(unsigned int i = 0; i < count; ++i)
+    {
+      const auto j  = (i + 1) % count;
+      const auto di = planeDistance(pIn[i], plane);
+      const auto dj = planeDistance(pIn[j], plane);
+
+      if(di >= 0)
+      {
+        points[size] = pIn[i];
+        barycentric[size++] = bIn[i];
+      }
+
+      if((di >= 0) != (dj >= 0))
+      {
+        const auto t = di / (di - dj);
+        points[size] = pIn[i] + (pIn[j] - pIn[i]) * t;
+        barycentric[size++] = bIn[i] + (bIn[j] - bIn[i]) * t;
+      }
+    }
+  }
+
+  return size < 3 ? 0 : size;
+}
+
+//--------------------------------------------------------------------
+/** \brief Fragment function of the depth only passes. With it rasterize() writes the depth of the
+ *  fragments that pass the CLOSER test directly to the buffer, without atomic operations and without
+ *  computing the barycentric coordinates of the fragments. Only valid if no other thread writes the
+ *  pixels of the rectangle, as in the tiles of the pipeline.
+ *
+ */
+struct DepthOnly
+{
+  void operator()(const int x, const int y, const Vector3f &barycentric) const
+  {}
+};
+
+//--------------------------------------------------------------------
+/** \brief Rasterizes the triangle restricted to the given rectangle and calls the given function with
+ *  the pixel coordinates and the perspective correct barycentric coordinates of every fragment that
+ *  passes the depth test. Returns the number of fragments that passed the test.
+ * \param[in] sPts pointer to augmented triangle points.
+ * \param[inout] buffer zBuffer object.
+ * \param[in] bmin rectangle minimum pixel coordinates.
+ * \param[in] bmax rectangle maximum pixel coordinates, inclusive.
+ * \param[in] test depth test of the fragments.
+ * \param[in] fragment function called as fragment(x, y, barycentric).
+ *
+ */
+template<class Function>
+unsigned long rasterize(const Vector4f *sPts, zBuffer &buffer, const Vector2i &bmin, const Vector2i &bmax, const GL_Impl::DEPTH_TEST test, Function fragment)
 {
   Matrix<float,3,4> points;
   Vector2f pts[3];
+  Vector2i min, max;
+
+  screenBounds(sPts, points, pts, bmin, bmax, min, max);
+
+  // triangle setup in fixed point: the vertices are snapped to the sub-pixel grid and the edge functions
+  // are evaluated with integers, so the coverage is exact and doesn't depend on the tile or thread that
+  // rasterizes the triangle. The edge function of vertex i is positive on its side of the opposite edge.
+  const long long X[3] = { snap(pts[0][0]), snap(pts[1][0]), snap(pts[2][0]) };
+  const long long Y[3] = { snap(pts[0][1]), snap(pts[1][1]), snap(pts[2][1]) };
+
+  long long A[3], B[3], C[3];
   for(int i = 0; i < 3; ++i)
   {
-    points[i] = ViewPort*sPts[i];
-    auto point = points[i].project();
-    pts[i][0] = point[0];
-    pts[i][1] = point[1];
+    const auto j = (i + 1) % 3;
+    const auto k = (i + 2) % 3;
+    A[i] = Y[j] - Y[k];
+    B[i] = X[k] - X[j];
+    C[i] = X[j] * Y[k] - X[k] * Y[j];
+  }
+
+  auto area = C[0] + C[1] + C[2];
+
+  // if the area is zero then triangle is degenerate and has no coverage.
+  if (area == 0) return 0;
+
+  // clockwise triangles are reoriented so the inside is where all the edge functions are positive.
+  if (area < 0)
+  {
+    for(int i = 0; i < 3; ++i)
+    {
+      A[i] = -A[i];
+      B[i] = -B[i];
+      C[i] = -C[i];
+    }
+    area = -area;
+  }
+
+  // top-left fill rule: pixels exactly on an edge belong to the triangle only if it's a left edge or a
+  // top one (of the final image, y grows upwards here), so shared edges are rasterized once.
+  long long bias[3];
+  for(int i = 0; i < 3; ++i)
+  {
+    bias[i] = (A[i] > 0 || (A[i] == 0 && B[i] < 0)) ? 0 : -1;
   }
 
-  const auto width  = image.getWidth();
-  const auto height = image.getHeight();
+  // edge function values at the pixel and its horizontal step.
+  auto edge = [&](const int i, const int x, const int y) { return A[i] * (x << SUBPIXEL_BITS) + B[i] * (y << SUBPIXEL_BITS) + C[i]; };
+  const long long step[3] = { A[0] << SUBPIXEL_BITS, A[1] << SUBPIXEL_BITS, A[2] << SUBPIXEL_BITS };
+
+  const auto invArea = 1.f / static_cast<float>(area);
+
+  // perspective correction and depth interpolation constants.
+  const float invW[3] = { 1.f/points[0][3], 1.f/points[1][3], 1.f/points[2][3] };
+  const float depth[3] = { points[0][2], points[1][2], points[2][2] };
+
+  const auto equal     = (test == GL_Impl::DEPTH_TEST::EQUAL);
+  const auto depthOnly = std::is_same<Function, DepthOnly>::value;
+  const auto zData     = depthOnly ? buffer.getBuffer() : nullptr;
+  unsigned long shaded = 0;
+
+  auto shade = [&](const int x, const int y, const Vector3f &bc_clip, const float z)
+  {
+    if (depthOnly)
+    {
+      auto &value = zData[y*buffer.getWidth() + x];
+      if(z > value)
+      {
+        value = z;
+        ++shaded;
+      }
+      return;
+    }
+
+    if (equal ? !buffer.checkEqual(x, y, z) : !buffer.checkAndSet(x, y, z)) return;
+
+    ++shaded;
+    fragment(x, y, bc_clip);
+  };
+
+  static const bool useAVX = static_cast<bool>(__builtin_cpu_supports("avx"));
+
+  if(useAVX)
+  {
+    // 8 pixels of a row at a time: coverage, perspective correction and an early depth test against
+    // the buffer are computed for all the lanes and the fragment function is only invoked for the surviving ones.
+    // The edge functions are integers below 2^53 so they are evaluated exactly in two double vectors.
+    // The early test reads the buffer without locking, that's safe as depth values only increase so a
+    // stale value can only let through a fragment that checkAndSet() will reject afterwards. In EQUAL
+    // mode the buffer is not modified and the early test is the final one.
+    const auto zPtr   = buffer.getBuffer();
+    const auto zWidth = buffer.getWidth();
+    const auto lanes  = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+    const auto one    = _mm256_set1_ps(1.f);
+    const auto right  = _mm256_set1_ps(max[0]);
+    const auto vArea  = _mm256_set1_ps(invArea);
+    const __m256 vInvW[3]  = { _mm256_set1_ps(invW[0]),  _mm256_set1_ps(invW[1]),  _mm256_set1_ps(invW[2])  };
+    const __m256 vDepth[3] = { _mm256_set1_ps(depth[0]), _mm256_set1_ps(depth[1]), _mm256_set1_ps(depth[2]) };
+
+    __m256d lo[3], hi[3], threshold[3];
+    for(int i = 0; i < 3; ++i)
+    {
+      lo[i] = _mm256_set_pd(3. * step[i], 2. * step[i], step[i], 0.);
+      hi[i] = _mm256_add_pd(lo[i], _mm256_set1_pd(4. * step[i]));
+      threshold[i] = _mm256_set1_pd(-bias[i]);
+    }
+
+    alignas(32) float bc0[8], bc1[8], bc2[8], zs[8];
+
+    const __m256d block[3] = { _mm256_set1_pd(8. * step[0]), _mm256_set1_pd(8. * step[1]), _mm256_set1_pd(8. * step[2]) };
+
+    for (int y = min[1]; y <= max[1]; ++y)
+    {
+      __m256d eLo[3], eHi[3];
+      for(int i = 0; i < 3; ++i)
+      {
+        const auto e = _mm256_set1_pd(static_cast<double>(edge(i, min[0], y)));
+        eLo[i] = _mm256_add_pd(e, lo[i]);
+        eHi[i] = _mm256_add_pd(e, hi[i]);
+      }
+
+      for (int x = min[0]; x <= max[0]; x += 8)
+      {
+        const __m256d bLo[3] = { eLo[0], eLo[1], eLo[2] };
+        const __m256d bHi[3] = { eHi[0], eHi[1], eHi[2] };
+        for(int i = 0; i < 3; ++i)
+        {
+          eLo[i] = _mm256_add_pd(eLo[i], block[i]);
+          eHi[i] = _mm256_add_pd(eHi[i], block[i]);
+        }
+
+        auto coverage = 0xFF;
+        for(int i = 0; i < 3; ++i)
+        {
+          coverage &= _mm256_movemask_pd(_mm256_cmp_pd(bLo[i], threshold[i], _CMP_GE_OQ)) |
+                      _mm256_movemask_pd(_mm256_cmp_pd(bHi[i], threshold[i], _CMP_GE_OQ)) << 4;
+        }
+
+        const auto inRow = _mm256_cmp_ps(_mm256_add_ps(lanes, _mm256_set1_ps(x)), right, _CMP_LE_OQ);
+        coverage &= _mm256_movemask_ps(inRow);
+
+        if (coverage == 0) continue;
+
+        __m256 l[3];
+        for(int i = 0; i < 3; ++i)
+        {
+          l[i] = _mm256_mul_ps(_mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(bLo[i])), _mm256_cvtpd_ps(bHi[i]), 1), vArea);
+        }
+
+        auto c0 = _mm256_mul_ps(l[0], vInvW[0]);
+        auto c1 = _mm256_mul_ps(l[1], vInvW[1]);
+        auto c2 = _mm256_mul_ps(l[2], vInvW[2]);
+        const auto norm = _mm256_div_ps(one, _mm256_add_ps(_mm256_add_ps(c0, c1), c2));
+        c0 = _mm256_mul_ps(c0, norm);
+        c1 = _mm256_mul_ps(c1, norm);
+        c2 = _mm256_mul_ps(c2, norm);
+
+        auto z = _mm256_mul_ps(vDepth[0], c0);
+        z = _mm256_add_ps(z, _mm256_mul_ps(vDepth[1], c1));
+        z = _mm256_add_ps(z, _mm256_mul_ps(vDepth[2], c2));
+
+        const auto current = _mm256_maskload_ps(zPtr + y*zWidth + x, _mm256_castps_si256(inRow));
+        const auto pass = equal ? _mm256_cmp_ps(z, current, _CMP_EQ_OQ) : _mm256_cmp_ps(z, current, _CMP_GT_OQ);
+        auto bits = coverage & _mm256_movemask_ps(pass);
+
+        if (bits == 0) continue;
+
+        _mm256_store_ps(zs, z);
+
+        // the early test is the final one, no other thread writes these pixels.
+        if (depthOnly)
+        {
+          shaded += __builtin_popcount(bits);
+          while (bits)
+          {
+            const auto lane = __builtin_ctz(bits);
+            bits &= bits - 1;
+
+            zData[y*zWidth + x + lane] = zs[lane];
+          }
+          continue;
+        }
 
-  Vector2i min{ std::numeric_limits<int>::max(),  std::numeric_limits<int>::max()};
-  Vector2i max{-std::numeric_limits<int>::max(), -std::numeric_limits<int>::max()};
-  Vector2i clamp{width-1, height-1};
+        _mm256_store_ps(bc0, c0);
+        _mm256_store_ps(bc1, c1);
+        _mm256_store_ps(bc2, c2);
 
-  for (int i: {0,1,2})
+        while (bits)
+        {
+          const auto lane = __builtin_ctz(bits);
+          bits &= bits - 1;
+
+          shade(x + lane, y, Vector3f{bc0[lane], bc1[lane], bc2[lane]}, zs[lane]);
+        }
+      }
+    }
+  }
+  else
   {
-    for (int j: {0,1})
+    for (int y = min[1]; y <= max[1]; ++y)
     {
-      min[j] = std::max(0, std::min(min[j], static_cast<int>(pts[i][j])));
-      max[j] = std::min(clamp[j], std::max(max[j], static_cast<int>(pts[i][j])));
+      long long e[3] = { edge(0, min[0], y), edge(1, min[0], y), edge(2, min[0], y) };
+
+      for (int x = min[0]; x <= max[0]; ++x, e[0] += step[0], e[1] += step[1], e[2] += step[2])
+      {
+        if(((e[0] + bias[0]) | (e[1] + bias[1]) | (e[2] + bias[2])) < 0) continue;
+
+        Vector3f bc_clip{static_cast<float>(e[0]) * invArea * invW[0], static_cast<float>(e[1]) * invArea * invW[1], static_cast<float>(e[2]) * invArea * invW[2]};
+        const auto norm = 1.f / (bc_clip[0]+bc_clip[1]+bc_clip[2]);
+        bc_clip[0] *= norm;
+        bc_clip[1] *= norm;
+        bc_clip[2] *= norm;
+
+        shade(x, y, bc_clip, depth[0]*bc_clip[0] + depth[1]*bc_clip[1] + depth[2]*bc_clip[2]);
+      }
     }
   }
 
-  Vector3f P{0,0,0};
+  return shaded;
+}
+
+//--------------------------------------------------------------------
+void GL_Impl::triangle(Vector4f *sPts, Shader &shader, zBuffer &buffer, Images::Image &image)
+{
+  const Vector2i bmin{0,0};
+  const Vector2i bmax{image.getWidth()-1, image.getHeight()-1};
 
-  for (P[0] = min[0]; P[0] <= max[0]; ++P[0])
+  switch(clipTest(sPts))
   {
-    for (P[1] = min[1]; P[1] <= max[1]; ++P[1])
+    case 0:
+      triangle(sPts, shader, buffer, image, bmin, bmax);
+      break;
+    case 1:
+      {
+        Vector4f points[MAX_CLIPPED];
+        Vector3f barycentric[MAX_CLIPPED];
+        const auto size = clip(sPts, points, barycentric);
+
+        shader.setup();
+
+        for(unsigned int i = 2; i < size; ++i)
+        {
+          const Vector4f fan[3]    = { points[0], points[i-1], points[i] };
+          const Vector3f fanBar[3] = { barycentric[0], barycentric[i-1], barycentric[i] };
+
+          auto shade = [&](const int x, const int y, const Vector3f &bc_clip)
+          {
+            Color color;
+            bool discard = shader.fragment(fanBar[0] * bc_clip[0] + fanBar[1] * bc_clip[1] + fanBar[2] * bc_clip[2], color);
+            if (!discard)
+            {
+              image.set(x, y, color);
+            }
+          };
+
+          rasterize(fan, buffer, bmin, bmax, DEPTH_TEST::CLOSER, shade);
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+//--------------------------------------------------------------------
+unsigned long GL_Impl::triangle(Vector4f *sPts, Shader &shader, zBuffer &buffer, Images::Image &image, const Vector2i &bmin, const Vector2i &bmax, const DEPTH_TEST test)
+{
+  shader.setup();
+
+  auto shade = [&](const int x, const int y, const Vector3f &bc_clip)
+  {
+    Color color;
+    bool discard = shader.fragment(bc_clip, color);
+    if (!discard)
     {
-      auto bc_screen = barycentric(pts, P);
-      auto bc_clip   = Vector3f{bc_screen[0]/points[0][3], bc_screen[1]/points[1][3], bc_screen[2]/points[2][3]};
-      bc_clip = bc_clip / (bc_clip[0]+bc_clip[1]+bc_clip[2]);
+      image.set(x, y, color);
+    }
+  };
 
-      if(bc_screen[0] < 0 || bc_screen[1] < 0 || bc_screen[2] < 0) continue;
+  return rasterize(sPts, buffer, bmin, bmax, test, shade);
+}
 
-      P[2] = points[0][2]*bc_clip[0] + points[1][2]*bc_clip[1] + points[2][2]*bc_clip[2];
-      if (!buffer.checkAndSet(P[0], P[1], P[2])) continue;
+//--------------------------------------------------------------------
+/** \brief Triangle after the geometry stage of the tiled pipeline.
+ *
+ */
+struct Triangle
+{
+  unsigned int  mesh;      /** mesh index.                  */
+  unsigned long face;      /** face index in the mesh.      */
+  Vector4f      points[3]; /** vertex shader output points. */
+  Vector2i      min;       /** screen bounding box minimum. */
+  Vector2i      max;       /** screen bounding box maximum. */
+  float         depth;     /** depth of the nearest vertex. */
+  bool          visible;   /** false if culled.             */
+  bool          clipped;   /** true if part of a clipped face, the points are not the face ones. */
+  Vector3f      bar[3];    /** barycentric coordinates of the points in the face if clipped.     */
+
+  /** \brief Returns the barycentric coordinates in the face of the given point of the triangle.
+   * \param[in] bc perspective correct barycentric coordinates in the triangle.
+   *
+   */
+  Vector3f faceBarycentric(const Vector3f &bc) const
+  { return clipped ? Vector3f(bar[0] * bc[0] + bar[1] * bc[1] + bar[2] * bc[2]) : bc; }
+};
 
+//--------------------------------------------------------------------
+/** \brief Sort-middle tiled pipeline shared by the draw methods. The triangles are transformed, culled
+ *  and binned into screen tiles and then each thread processes whole tiles calling the given raster
+ *  function for the triangles not rejected by the hierarchical z test. The factory is called at most
+ *  once per thread and the shaders are used by every stage and mesh of the draw. Prints the statistics.
+ * \param[in] meshes meshes to draw.
+ * \param[in] factory shader factory.
+ * \param[inout] buffer zBuffer object.
+ * \param[in] width width of the render target.
+ * \param[in] height height of the render target.
+ * \param[in] cull faces to cull by their winding.
+ * \param[in] tileSize side of the square tiles in pixels.
+ * \param[in] test depth test of the raster function.
+ * \param[in] raster function called as raster(shader, triangle, tileMin, tileMax) that returns the
+ *            number of fragments that passed the depth test.
+ *
+ */
+template<class ShaderT, class Function>
+void pipeline(const std::vector<std::shared_ptr<Mesh>> &meshes, const std::function<std::unique_ptr<ShaderT>()> &factory, zBuffer &buffer,
+              const int width, const int height, const GL_Impl::CULL_FACE cull, const unsigned int tileSize, const GL_Impl::DEPTH_TEST test, Function raster)
+{
+  // every parallel region of the draw uses the same team size so the thread number always indexes
+  // the shaders vector, the shaders are created by the first region each thread runs.
+  const int threads = omp_get_max_threads();
+  std::vector<std::unique_ptr<ShaderT>> shaders(threads);
+  shaders[0] = factory();
+
+  auto threadShader = [&]() -> std::unique_ptr<ShaderT> &
+  {
+    auto &shader = shaders[omp_get_thread_num()];
+    if(!shader) shader = factory();
+
+    return shader;
+  };
+
+  // geometry stage: vertex shading, clipping and culling of every face.
+  const Vector2i imageMin{0, 0};
+  const Vector2i imageMax{width-1, height-1};
+
+  unsigned long total = 0;
+  for(auto mesh: meshes) total += mesh->faces_num();
+
+  std::vector<Triangle> triangles(total);
+  unsigned long outside = 0, degenerate = 0, facing = 0, clipped = 0;
+
+  // computes the screen bounds and depth of the triangle and culls it, counting the reason.
+  auto setup = [&](Triangle &t, unsigned long &outside, unsigned long &degenerate, unsigned long &facing)
+  {
+    t.visible = false;
+
+    Matrix<float,3,4> points;
+    Vector2f pts[3];
+    screenBounds(t.points, points, pts, imageMin, imageMax, t.min, t.max);
+
+    // out of the image.
+    if(t.min[0] > t.max[0] || t.min[1] > t.max[1])
+    {
+      ++outside;
+      return;
+    }
+
+    // signed area, positive if the vertices are in counterclockwise order on the screen.
+    const auto area = (pts[1][0] - pts[0][0]) * (pts[2][1] - pts[0][1]) - (pts[2][0] - pts[0][0]) * (pts[1][1] - pts[0][1]);
+    if(area == 0)
+    {
+      ++degenerate;
+      return;
+    }
+
+    if((cull == GL_Impl::CULL_FACE::CLOCKWISE && area < 0) || (cull == GL_Impl::CULL_FACE::COUNTERCLOCKWISE && area > 0))
+    {
+      ++facing;
+      return;
+    }
+
+    t.visible = true;
+    t.depth   = std::max(points[0][2], std::max(points[1][2], points[2][2]));
+  };
+
+  // if the shader position is only a transformation of the mesh vertex every vertex of a mesh is
+  // transformed once and the faces are assembled from the transformed array, otherwise the vertex
+  // shader is called for every corner of the faces.
+  Matrix4f transform;
+  const bool batched = shaders[0]->clipTransform(transform);
+  std::vector<Vector4f> vertices;
+  unsigned long transformed = 0;
+
+  unsigned long offset = 0;
+  for(unsigned int m = 0; m < meshes.size(); ++m)
+  {
+    const auto &mesh = meshes[m];
+    const long vertexNum = batched ? mesh->vertex_num() : 0;
+
+    vertices.resize(vertexNum);
+    transformed += batched ? vertexNum : 3 * mesh->faces_num();
+
+    #pragma omp parallel num_threads(threads) reduction(+:outside,degenerate,facing,clipped)
+    {
+      auto &shader = threadShader();
+      shader->setMesh(mesh.get());
+
+      #pragma omp for schedule(static)
+      for (long v = 0; v < vertexNum; ++v)
+      {
+        vertices[v] = transform * mesh->getVertex(v).augment();
+      }
+
+      #pragma omp for schedule(static)
+      for (unsigned long i = 0; i < mesh->faces_num(); i++)
+      {
+        auto &t = triangles[offset + i];
+        t.mesh    = m;
+        t.face    = i;
+        t.clipped = false;
+        if(batched)
+        {
+          const auto ids = mesh->getFaceVertexIds(i);
+          for (int j = 0; j < 3; j++)
+          {
+            t.points[j] = vertices[ids[j]];
+          }
+        }
+        else
+        {
+          for (int j = 0; j < 3; j++)
+          {
+            t.points[j] = shader->vertex(i, j);
+          }
+        }
+
+        switch(clipTest(t.points))
+        {
+          case 0:
+            setup(t, outside, degenerate, facing);
+            break;
+          case 1:
+            // clipped after the stage, the face is replaced by the pieces.
+            t.visible = false;
+            t.clipped = true;
+            ++clipped;
+            break;
+          default:
+            t.visible = false;
+            ++outside;
+            break;
+        }
+      }
+    }
+
+    offset += mesh->faces_num();
+  }
+
+  // the faces crossing the near or far planes or leaving the guard band are rare, they are clipped
+  // and triangulated after the parallel stage.
+  if(clipped != 0)
+  {
+    for(unsigned long i = 0; i < total; ++i)
+    {
+      if(!triangles[i].clipped) continue;
+
+      Vector4f points[MAX_CLIPPED];
+      Vector3f barycentric[MAX_CLIPPED];
+      const auto size = clip(triangles[i].points, points, barycentric);
+
+      for(unsigned int j = 2; j < size; ++j)
+      {
+        Triangle t = triangles[i];
+        t.points[0] = points[0];
+        t.points[1] = points[j-1];
+        t.points[2] = points[j];
+        t.bar[0]    = barycentric[0];
+        t.bar[1]    = barycentric[j-1];
+        t.bar[2]    = barycentric[j];
+
+        setup(t, outside, degenerate, facing);
+        if(t.visible) triangles.push_back(t);
+      }
+    }
+  }
+
+  // binning stage: tiles keep the triangles overlapping them in submission order.
+  const int size    = tileSize;
+  const int tilesX  = (width  + size - 1) / size;
+  const int tilesY  = (height + size - 1) / size;
+
+  std::vector<std::vector<unsigned long>> bins(tilesX * tilesY);
+  std::vector<float> binDepth(bins.size(), -std::numeric_limits<float>::max());
+  unsigned long binned = 0;
+
+  for (unsigned long i = 0; i < triangles.size(); ++i)
+  {
+    const auto &t = triangles[i];
+    if(!t.visible) continue;
+
+    for(int ty = t.min[1] / size; ty <= t.max[1] / size; ++ty)
+    {
+      for(int tx = t.min[0] / size; tx <= t.max[0] / size; ++tx)
+      {
+        bins[ty * tilesX + tx].push_back(i);
+        binDepth[ty * tilesX + tx] = std::max(binDepth[ty * tilesX + tx], t.depth);
+        ++binned;
+      }
+    }
+  }
+
+  // raster stage: each thread owns whole tiles. Tiles and triangles that are behind the contents
+  // of the buffer when the draw starts are rejected using its hierarchical levels. Tiles that are
+  // not rasterized keep a negative time. The EQUAL test doesn't reject, the interpolated depths
+  // stored by a previous pass can be slightly above the vertex depths of the triangle that wrote
+  // them and the triangle would leave holes.
+  const bool reject = (test != GL_Impl::DEPTH_TEST::EQUAL);
+  if(reject) buffer.updateHierarchy();
+
+  std::vector<double> times(bins.size(), -1.);
+  unsigned int culledTiles = 0;
+  unsigned long culledTriangles = 0;
+  unsigned long fragments = 0;
+
+  #pragma omp parallel num_threads(threads) reduction(+:culledTiles,culledTriangles,fragments)
+  {
+    auto &shader = threadShader();
+
+    #pragma omp for schedule(dynamic,1)
+    for (unsigned int tile = 0; tile < bins.size(); ++tile)
+    {
+      if(bins[tile].empty()) continue;
+
+      const auto start = std::chrono::high_resolution_clock::now();
+
+      const int tx = tile % tilesX;
+      const int ty = tile / tilesX;
+      const Vector2i tileMin{tx * size, ty * size};
+      const Vector2i tileMax{std::min(width, (tx + 1) * size) - 1, std::min(height, (ty + 1) * size) - 1};
+
+      if(reject && buffer.isOccluded(tileMin, tileMax, binDepth[tile]))
+      {
+        ++culledTiles;
+        culledTriangles += bins[tile].size();
+        continue;
+      }
+
+      for(auto id: bins[tile])
+      {
+        const auto &t = triangles[id];
+
+        const Vector2i min{std::max(t.min[0], tileMin[0]), std::max(t.min[1], tileMin[1])};
+        const Vector2i max{std::min(t.max[0], tileMax[0]), std::min(t.max[1], tileMax[1])};
+        if(reject && buffer.isOccluded(min, max, t.depth))
+        {
+          ++culledTriangles;
+          continue;
+        }
+
+        fragments += raster(*shader, t, tileMin, tileMax);
+      }
+
+      const auto end = std::chrono::high_resolution_clock::now();
+      times[tile] = std::chrono::duration<double, std::milli>(end - start).count();
+    }
+  }
+
+  // tile statistics.
+  unsigned int used = 0;
+  unsigned int slowest = 0;
+  double minTime = std::numeric_limits<double>::max();
+  double sumTime = 0;
+  for(unsigned int tile = 0; tile < bins.size(); ++tile)
+  {
+    if(times[tile] < 0) continue;
+
+    sumTime += times[tile];
+    minTime  = std::min(minTime, times[tile]);
+    if(used == 0 || times[tile] > times[slowest]) slowest = tile;
+    ++used;
+  }
+
+  std::cout << "transformed vertices: " << transformed << " face corners: " << 3 * total << std::endl;
+  std::cout << "culled faces: outside " << outside << " zero area " << degenerate << " winding " << facing << " clipped faces: " << clipped << std::endl;
+  std::cout << "triangles: " << total << " binned: " << binned << " tiles: " << used << "/" << bins.size() << " (" << size << "x" << size << ")" << std::endl;
+  std::cout << "hierarchical z culled tiles: " << culledTiles << " culled triangles: " << culledTriangles << "/" << binned << std::endl;
+  std::cout << "fragments: " << fragments << " screen pixels: " << width * height << " (" << static_cast<double>(fragments) / (width * height) << " per pixel)" << std::endl;
+  if(used != 0)
+  {
+    std::cout << "tile time min/avg/max: " << minTime << "/" << sumTime / used << "/" << times[slowest] << " ms, slowest tile: ";
+    std::cout << slowest % tilesX << "," << slowest / tilesX << " with " << bins[slowest].size() << " triangles." << std::endl;
+  }
+  std::cout << std::flush;
+}
+
+//--------------------------------------------------------------------
+/** \brief Implementation of the draw methods. The vertex and fragment methods are called through ShaderT
+ *  so the calls are resolved at compile time when ShaderT is a final class. When built with FRAGMENT_CYCLES
+ *  prints the cycles spent in the fragment shader.
+ * \param[in] meshes meshes to draw.
+ * \param[in] factory shader factory.
+ * \param[inout] buffer zBuffer object.
+ * \param[inout] image image to draw on.
+ * \param[in] test depth test of the fragments.
+ * \param[in] cull faces to cull by their winding.
+ * \param[in] tileSize side of the square tiles in pixels.
+ *
+ */
+template<class ShaderT>
+void drawShaded(const std::vector<std::shared_ptr<Mesh>> &meshes, const std::function<std::unique_ptr<ShaderT>()> &factory, zBuffer &buffer, Images::Image &image,
+                const GL_Impl::DEPTH_TEST test, const GL_Impl::CULL_FACE cull, const unsigned int tileSize)
+{
+#ifdef FRAGMENT_CYCLES
+  // cycles and fragments of each tile, a tile is rasterized by a single thread so no atomics are needed.
+  const int tilesX = (image.getWidth() + tileSize - 1) / tileSize;
+  const int tilesY = (image.getHeight() + tileSize - 1) / tileSize;
+  std::vector<unsigned long long> cycles(tilesX * tilesY, 0);
+  std::vector<unsigned long long> fragments(tilesX * tilesY, 0);
+#endif
+
+  auto raster = [&](ShaderT &shader, const Triangle &t, const Vector2i &tileMin, const Vector2i &tileMax)
+  {
+    if(shader.mesh() != meshes[t.mesh].get()) shader.setMesh(meshes[t.mesh].get());
+
+    // vertex shading again to set the shader varyings of the face.
+    for (int j = 0; j < 3; j++)
+    {
+      shader.vertex(t.face, j);
+    }
+    shader.setup();
+
+#ifdef FRAGMENT_CYCLES
+    const auto tile = (tileMin[1] / tileSize) * tilesX + tileMin[0] / tileSize;
+    auto &tileCycles = cycles[tile];
+#endif
+
+    auto shade = [&](const int x, const int y, const Vector3f &bc_clip)
+    {
       Color color;
-      bool discard = shader.fragment(bc_clip, color);
+#ifdef FRAGMENT_CYCLES
+      const auto start = __rdtsc();
+#endif
+      bool discard = shader.fragment(t.faceBarycentric(bc_clip), color);
+#ifdef FRAGMENT_CYCLES
+      tileCycles += __rdtsc() - start;
+#endif
       if (!discard)
       {
-        image.set(P[0], P[1], color);
+        image.set(x, y, color);
+      }
+    };
+
+    const auto shaded = rasterize(t.points, buffer, tileMin, tileMax, test, shade);
+
+#ifdef FRAGMENT_CYCLES
+    fragments[tile] += shaded;
+#endif
+
+    return shaded;
+  };
+
+  pipeline(meshes, factory, buffer, image.getWidth(), image.getHeight(), cull, tileSize, test, raster);
+
+#ifdef FRAGMENT_CYCLES
+  unsigned long long totalCycles = 0, totalFragments = 0;
+  for(unsigned int tile = 0; tile < cycles.size(); ++tile)
+  {
+    totalCycles    += cycles[tile];
+    totalFragments += fragments[tile];
+  }
+
+  if(totalFragments != 0)
+  {
+    std::cout << "fragment shader cycles: " << static_cast<double>(totalCycles) / totalFragments << " per fragment." << std::endl << std::flush;
+  }
+#endif
+}
+
+//--------------------------------------------------------------------
+void GL_Impl::draw(const std::vector<std::shared_ptr<Mesh>> &meshes, const ShaderFactory &factory, zBuffer &buffer, Images::Image &image,
+                   const DEPTH_TEST test, const CULL_FACE cull, const unsigned int tileSize)
+{
+  drawShaded(meshes, factory, buffer, image, test, cull, tileSize);
+}
+
+//--------------------------------------------------------------------
+template<class ShaderT>
+void GL_Impl::draw(const std::vector<std::shared_ptr<Mesh>> &meshes, const std::function<std::unique_ptr<ShaderT>()> &factory, zBuffer &buffer, Images::Image &image,
+                   const DEPTH_TEST test, const CULL_FACE cull, const unsigned int tileSize)
+{
+  drawShaded(meshes, factory, buffer, image, test, cull, tileSize);
+}
+
+// the final shaders of Shaders.h get their own raster loop.
+#define DRAW_INSTANCE(ShaderT) template void GL_Impl::draw<ShaderT>(const std::vector<std::shared_ptr<Mesh>> &, const std::function<std::unique_ptr<ShaderT>()> &, \
+                                                                    zBuffer &, Images::Image &, const DEPTH_TEST, const CULL_FACE, const unsigned int);
+DRAW_INSTANCE(CellShader)
+DRAW_INSTANCE(MultiShader)
+DRAW_INSTANCE(NormalMapping)
+DRAW_INSTANCE(TexturedSpecularShader)
+DRAW_INSTANCE(PhongShader)
+DRAW_INSTANCE(EmptyShader)
+DRAW_INSTANCE(HardShadowsShader)
+DRAW_INSTANCE(FinalShader)
+#undef DRAW_INSTANCE
+
+//--------------------------------------------------------------------
+void GL_Impl::drawDepth(const std::vector<std::shared_ptr<Mesh>> &meshes, const ShaderFactory &factory, zBuffer &buffer,
+                        const CULL_FACE cull, const unsigned int tileSize)
+{
+  auto raster = [&](Shader &shader, const Triangle &t, const Vector2i &tileMin, const Vector2i &tileMax)
+  {
+    return rasterize(t.points, buffer, tileMin, tileMax, DEPTH_TEST::CLOSER, DepthOnly());
+  };
+
+  pipeline(meshes, factory, buffer, buffer.getWidth(), buffer.getHeight(), cull, tileSize, DEPTH_TEST::CLOSER, raster);
+}
+
+//--------------------------------------------------------------------
+void GL_Impl::drawVisibility(const std::vector<std::shared_ptr<Mesh>> &meshes, const ShaderFactory &factory, zBuffer &buffer, VisibilityBuffer &visibility,
+                             const DEPTH_TEST test, const CULL_FACE cull, const unsigned int tileSize)
+{
+  auto raster = [&](Shader &shader, const Triangle &t, const Vector2i &tileMin, const Vector2i &tileMax)
+  {
+    auto store = [&](const int x, const int y, const Vector3f &bc_clip)
+    {
+      visibility.set(x, y, t.mesh, t.face, t.faceBarycentric(bc_clip));
+    };
+
+    return rasterize(t.points, buffer, tileMin, tileMax, test, store);
+  };
+
+  pipeline(meshes, factory, buffer, visibility.getWidth(), visibility.getHeight(), cull, tileSize, test, raster);
+}
+
+//--------------------------------------------------------------------
+void GL_Impl::shade(const std::vector<std::shared_ptr<Mesh>> &meshes, const ShaderFactory &factory, const VisibilityBuffer &visibility, Images::Image &image)
+{
+  const int width  = visibility.getWidth();
+  const int height = visibility.getHeight();
+
+  unsigned long pixels = 0;
+  unsigned long setups = 0;
+
+  const auto start = std::chrono::high_resolution_clock::now();
+
+  #pragma omp parallel reduction(+:pixels,setups)
+  {
+    auto shader = factory();
+    auto mesh   = VisibilityBuffer::EMPTY;
+    unsigned long face = 0;
+
+    #pragma omp for schedule(dynamic,1)
+    for (int y = 0; y < height; ++y)
+    {
+      for (int x = 0; x < width; ++x)
+      {
+        const auto &sample = visibility.get(x, y);
+        if(sample.mesh == VisibilityBuffer::EMPTY) continue;
+
+        // neighbour pixels usually belong to the same face, the varyings are only set when it changes.
+        if(sample.mesh != mesh || sample.face != face)
+        {
+          shader->setMesh(meshes[sample.mesh].get());
+
+          mesh = sample.mesh;
+          face = sample.face;
+
+          for (int j = 0; j < 3; j++)
+          {
+            shader->vertex(face, j);
+          }
+          shader->setup();
+          ++setups;
+        }
+
+        const auto &bc = sample.barycentric;
+
+        Color color;
+        bool discard = shader->fragment(Vector3f{1.f - bc[0] - bc[1], bc[0], bc[1]}, color);
+        if (!discard)
+        {
+          image.set(x, y, color);
+        }
+        ++pixels;
       }
     }
   }
+
+  const auto end = std::chrono::high_resolution_clock::now();
+
+  std::cout << "shaded pixels: " << pixels << " screen pixels: " << width * height << " face setups: " << setups;
+  std::cout << " time: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl << std::flush;
 }
 
 //--------------------------------------------------------------------
@@ -285,7 +1187,7 @@ float GL_Impl::max_elevation_angle(zBuffer &buffer, Vector2f point, Vector2f dir
   {
     for (t = 0.; t < 1000.; t += 1.)
     {
-      auto current = point + direction * t;
+      const Vector2f current = point + direction * t;
       if (current[0] >= buffer.getWidth() || current[1] >= buffer.getHeight() || current[0] < 0 || current[1] < 0) break;
 
       auto distance = (point - current).norm();
@@ -24,6 +24,11 @@
 #include "Images.h"
 #include "Algebra.h"
 
+// C++
+#include <functional>
+#include <memory>
+#include <vector>
+
 extern Vector3f Light;
 extern Matrix4f ViewPort;
 extern Matrix4f ModelView;
@@ -34,6 +39,7 @@ class Mesh;
 namespace Utils
 {
   class zBuffer;
+  class VisibilityBuffer;
 }
 
 namespace GL_Impl
@@ -44,7 +50,36 @@ namespace GL_Impl
       virtual Vector4f vertex(int iface, int nthvert) = 0;
       virtual bool fragment(Vector3f bar, Images::Color &color) = 0;
 
-      std::shared_ptr<Mesh> uniform_mesh;
+      /** \brief Called once per triangle after vertex() has been called for its three vertices, computes
+       *  the values shared by all the fragments of the triangle.
+       *
+       */
+      virtual void setup()
+      {}
+
+      /** \brief Returns true if the point returned by vertex() is the mesh vertex transformed by a matrix,
+       *  so the draw methods can transform every vertex of the mesh once, and false otherwise.
+       * \param[out] matrix vertex transformation matrix.
+       *
+       */
+      virtual bool clipTransform(Matrix4f &matrix) const
+      { return false; }
+
+      /** \brief Sets the mesh being drawn, the shaders that hold other shaders pass it to them.
+       * \param[in] mesh mesh pointer, owned by the caller of the draw methods.
+       *
+       */
+      virtual void setMesh(Mesh *mesh)
+      { uniform_mesh = mesh; }
+
+      /** \brief Returns the mesh being drawn.
+       *
+       */
+      Mesh *mesh() const
+      { return uniform_mesh; }
+
+    protected:
+      Mesh *uniform_mesh = nullptr; // mesh being drawn, set with setMesh().
   };
 
   /** \brief Creates the viewport matrix.
@@ -81,7 +116,20 @@ namespace GL_Impl
    */
   void line(int x0, int y0, int x1, int y1, Images::Image &image, const Images::Color &color);
 
-  /** \brief Draws a given triangle in the given color on the given image.
+  /** \brief Depth test of the fragments against the zBuffer values.
+   *  CLOSER: the fragment passes if it's closer than the stored value, which is then updated.
+   *  EQUAL : the fragment passes if it has the stored value, the buffer is not modified. Used to shade
+   *          only the visible fragments after a pass that has filled the buffer with the same geometry.
+   */
+  enum class DEPTH_TEST: char { CLOSER = 0, EQUAL };
+
+  /** \brief Winding on the screen of the faces discarded before the rasterization. The faces of the
+   *  Wavefront models are counterclockwise so CLOCKWISE culls the back faces.
+   */
+  enum class CULL_FACE: char { NONE = 0, CLOCKWISE, COUNTERCLOCKWISE };
+
+  /** \brief Draws a given triangle in the given color on the given image. The triangle is clipped against
+   *  the near and far planes and the guard band first.
    * \param[in] sPts pointer to augmented triangle points.
    * \param[in] shader vertex & fragment shader.
    * \param[inout] buffer zBuffer object.
@@ -90,6 +138,91 @@ namespace GL_Impl
    */
   void triangle(Vector4f *sPts, Shader &shader, Utils::zBuffer &buffer, Images::Image &image);
 
+  /** \brief Draws a given triangle restricted to the given rectangle of the image. The triangle must be
+   *  inside the near and far planes and the guard band.
+   * \param[in] sPts pointer to augmented triangle points.
+   * \param[in] shader vertex & fragment shader.
+   * \param[inout] buffer zBuffer object.
+   * \param[inout] image TGA image raw pointer.
+   * \param[in] bmin rectangle minimum pixel coordinates.
+   * \param[in] bmax rectangle maximum pixel coordinates, inclusive.
+   * \param[in] test depth test of the fragments.
+   *
+   * Returns the number of fragments that passed the depth test and were shaded.
+   */
+  unsigned long triangle(Vector4f *sPts, Shader &shader, Utils::zBuffer &buffer, Images::Image &image, const Vector2i &bmin, const Vector2i &bmax, const DEPTH_TEST test = DEPTH_TEST::CLOSER);
+
+  /** \brief Returns a new shader with its uniforms set, called once per rendering thread. */
+  using ShaderFactory = std::function<std::unique_ptr<Shader>()>;
+
+  /** \brief Draws the meshes with a sort-middle tiled pipeline: the triangles are transformed and binned
+   *  into screen tiles and then each thread rasterizes whole tiles, so no pixel is shared between threads.
+   *  Prints the culling and per-tile timing statistics and the number of shaded fragments.
+   * \param[in] meshes meshes to draw.
+   * \param[in] factory shader factory.
+   * \param[inout] buffer zBuffer object.
+   * \param[inout] image image to draw on.
+   * \param[in] test depth test of the fragments.
+   * \param[in] cull faces to cull by their winding, the faces out of the image and with zero area are always culled.
+   * \param[in] tileSize side of the square tiles in pixels.
+   *
+   */
+  void draw(const std::vector<std::shared_ptr<Mesh>> &meshes, const ShaderFactory &factory, Utils::zBuffer &buffer, Images::Image &image,
+            const DEPTH_TEST test = DEPTH_TEST::CLOSER, const CULL_FACE cull = CULL_FACE::NONE, const unsigned int tileSize = 64);
+
+  /** \brief Draws the meshes like draw() but with the shader type known at compile time, the raster loop is
+   *  specialized for ShaderT and the vertex and fragment calls are resolved statically, as the final shaders
+   *  of Shaders.h are, for which it is instantiated. Called as draw<ShaderT>(...).
+   * \param[in] meshes meshes to draw.
+   * \param[in] factory shader factory.
+   * \param[inout] buffer zBuffer object.
+   * \param[inout] image image to draw on.
+   * \param[in] test depth test of the fragments.
+   * \param[in] cull faces to cull by their winding, the faces out of the image and with zero area are always culled.
+   * \param[in] tileSize side of the square tiles in pixels.
+   *
+   */
+  template<class ShaderT>
+  void draw(const std::vector<std::shared_ptr<Mesh>> &meshes, const std::function<std::unique_ptr<ShaderT>()> &factory, Utils::zBuffer &buffer, Images::Image &image,
+            const DEPTH_TEST test = DEPTH_TEST::CLOSER, const CULL_FACE cull = CULL_FACE::NONE, const unsigned int tileSize = 64);
+
+  /** \brief Draws the meshes with the same tiled pipeline as draw() but only the depth buffer is written,
+   *  there is no color target and the fragment shader isn't called. The depth is the same draw() computes.
+   * \param[in] meshes meshes to draw.
+   * \param[in] factory shader factory, only the vertex shader is used.
+   * \param[inout] buffer zBuffer object.
+   * \param[in] cull faces to cull by their winding.
+   * \param[in] tileSize side of the square tiles in pixels.
+   *
+   */
+  void drawDepth(const std::vector<std::shared_ptr<Mesh>> &meshes, const ShaderFactory &factory, Utils::zBuffer &buffer,
+                 const CULL_FACE cull = CULL_FACE::NONE, const unsigned int tileSize = 64);
+
+  /** \brief Draws the meshes with the same tiled pipeline as draw() but without shading, the mesh and face
+   *  indices and the barycentric coordinates of the visible fragment are stored in the visibility buffer
+   *  to be shaded later with shade().
+   * \param[in] meshes meshes to draw.
+   * \param[in] factory shader factory, only the vertex shader is used.
+   * \param[inout] buffer zBuffer object.
+   * \param[inout] visibility visibility buffer.
+   * \param[in] test depth test of the fragments.
+   * \param[in] cull faces to cull by their winding.
+   * \param[in] tileSize side of the square tiles in pixels.
+   *
+   */
+  void drawVisibility(const std::vector<std::shared_ptr<Mesh>> &meshes, const ShaderFactory &factory, Utils::zBuffer &buffer, Utils::VisibilityBuffer &visibility,
+                      const DEPTH_TEST test = DEPTH_TEST::CLOSER, const CULL_FACE cull = CULL_FACE::NONE, const unsigned int tileSize = 64);
+
+  /** \brief Shades once every pixel of the visibility buffer, the rows of the image are distributed
+   *  among the threads. Prints the number of shaded pixels and face setups.
+   * \param[in] meshes meshes used to fill the visibility buffer.
+   * \param[in] factory shader factory.
+   * \param[in] visibility visibility buffer.
+   * \param[inout] image image to draw on.
+   *
+   */
+  void shade(const std::vector<std::shared_ptr<Mesh>> &meshes, const ShaderFactory &factory, const Utils::VisibilityBuffer &visibility, Images::Image &image);
+
   /** \brief Computes the slope of the given pixel p in the direction dir with the information of the z-buffer.
    * \param[in] buffer zBuffer object.
    * \param[in] point point coordinates.
@@ -22,19 +22,29 @@
 #include "Images.h"
 
 // C++
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iosfwd>
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <map>
 #include <memory>
 #include <sstream>
+#include <tuple>
 
 using namespace Images;
 
+// textures of the meshes without material.
+static const Material::Textures NO_TEXTURES;
+
 //--------------------------------------------------------------------
 Mesh::Mesh(const std::string &id)
 : m_id      {id}
+, m_welded  {false}
 , m_material{nullptr}
+, m_textures{&NO_TEXTURES}
 {
 }
 
@@ -51,9 +61,11 @@ void Mesh::addVertex(const Vector3f &v)
 }
 
 //--------------------------------------------------------------------
-void Mesh::addFace(const Face &f)
+void Mesh::addFace(const unsigned int vertex[3], const unsigned int uv[3], const unsigned int normal[3])
 {
-  m_faces.push_back(f);
+  m_vertexIds.insert(m_vertexIds.end(), vertex, vertex + 3);
+  m_uvIds.insert(m_uvIds.end(), uv, uv + 3);
+  m_normalIds.insert(m_normalIds.end(), normal, normal + 3);
 }
 
 //--------------------------------------------------------------------
@@ -81,16 +93,230 @@ void Mesh::addNormal(const Vector3f &n)
 }
 
 //--------------------------------------------------------------------
-Images::Color Mesh::getDiffuse(const float u, const float v)
+void Mesh::weld()
 {
-  auto texture = m_material->getTexture(m_mtl, Material::TYPE::DIFFUSE);
+  if(m_welded) return;
+
+  std::map<std::tuple<unsigned int, unsigned int, unsigned int>, unsigned int> ids;
+  std::vector<Vector3f> vertices, normals;
+  std::vector<Vector2f> uv;
+
+  for(unsigned long i = 0; i < m_vertexIds.size(); ++i)
+  {
+    const auto key = std::make_tuple(m_vertexIds[i], m_uvIds[i], m_normalIds[i]);
+    auto it = ids.find(key);
+
+    if(it == ids.end())
+    {
+      it = ids.emplace(key, vertices.size()).first;
+      vertices.push_back(m_vertices[m_vertexIds[i]]);
+      uv.push_back(m_uv[m_uvIds[i]]);
+      normals.push_back(m_normals[m_normalIds[i]]);
+    }
+
+    m_vertexIds[i] = it->second;
+  }
+
+  m_vertices.swap(vertices);
+  m_uv.swap(uv);
+  m_normals.swap(normals);
+
+  m_uvIds.clear();
+  m_uvIds.shrink_to_fit();
+  m_normalIds.clear();
+  m_normalIds.shrink_to_fit();
+
+  m_welded = true;
+}
+
+//--------------------------------------------------------------------
+double Mesh::acmr(const unsigned int cacheSize) const
+{
+  if(faces_num() == 0) return 0;
+
+  std::vector<unsigned int> cache;
+  unsigned long misses = 0;
+
+  for(auto id: m_vertexIds)
+  {
+    auto it = std::find(cache.begin(), cache.end(), id);
+    if(it != cache.end())
+    {
+      cache.erase(it);
+    }
+    else
+    {
+      ++misses;
+      if(cache.size() == cacheSize) cache.pop_back();
+    }
+
+    cache.insert(cache.begin(), id);
+  }
+
+  return static_cast<double>(misses) / faces_num();
+}
+
+//--------------------------------------------------------------------
+void Mesh::optimizeFaces(const unsigned int cacheSize)
+{
+  const unsigned long faces = faces_num();
+  if(faces == 0 || cacheSize <= 3) return;
+
+  // score of a vertex given its position in the cache and the number of faces not yet drawn that use it.
+  auto vertexScore = [cacheSize](const int position, const unsigned int remaining)
+  {
+    if(remaining == 0) return -1.f;
+
+    float score = 0.f;
+    if(position >= 0)
+    {
+      // the last face vertices get a fixed score so the next face doesn't reuse the same edge.
+      if(position < 3) score = 0.75f;
+      else             score = std::pow(1.f - static_cast<float>(position - 3) / (cacheSize - 3), 1.5f);
+    }
+
+    // vertices with few faces left are drawn first so they don't stay alone.
+    return score + 2.f / std::sqrt(static_cast<float>(remaining));
+  };
+
+  unsigned long vertices = 0;
+  for(auto id: m_vertexIds) vertices = std::max<unsigned long>(vertices, id + 1);
+
+  // faces of every vertex.
+  std::vector<unsigned int> offsets(vertices + 1, 0);
+  for(auto id: m_vertexIds) ++offsets[id + 1];
+  for(unsigned long v = 0; v < vertices; ++v) offsets[v + 1] += offsets[v];
+
+  std::vector<unsigned int> adjacency(m_vertexIds.size());
+  std::vector<unsigned int> remaining(vertices, 0);
+  for(unsigned long i = 0; i < m_vertexIds.size(); ++i)
+  {
+    const auto id = m_vertexIds[i];
+    adjacency[offsets[id] + remaining[id]++] = i / 3;
+  }
+
+  std::vector<int>   position(vertices, -1);
+  std::vector<float> score(vertices);
+  for(unsigned long v = 0; v < vertices; ++v) score[v] = vertexScore(-1, remaining[v]);
+
+  std::vector<float> faceScore(faces);
+  std::vector<bool>  drawn(faces, false);
+
+  auto updateScore = [&](const unsigned long f)
+  {
+    faceScore[f] = score[m_vertexIds[3*f]] + score[m_vertexIds[3*f+1]] + score[m_vertexIds[3*f+2]];
+  };
+
+  for(unsigned long f = 0; f < faces; ++f) updateScore(f);
+
+  std::vector<unsigned int> order;
+  order.reserve(faces);
+
+  std::vector<unsigned int> cache, next;
+  long best = -1;
+  unsigned long cursor = 0;
+
+  while(order.size() < faces)
+  {
+    // no face uses the vertices in the cache, the next one is searched in submission order.
+    if(best < 0)
+    {
+      float bestScore = -1.f;
+      for(; cursor < faces && drawn[cursor]; ++cursor);
+      for(auto f = cursor; f < faces; ++f)
+      {
+        if(!drawn[f] && faceScore[f] > bestScore)
+        {
+          bestScore = faceScore[f];
+          best      = f;
+        }
+      }
+    }
+
+    drawn[best] = true;
+    order.push_back(best);
+
+    // the vertices of the face move to the front of the cache.
+    next.assign(m_vertexIds.begin() + 3*best, m_vertexIds.begin() + 3*best + 3);
+    for(int j = 0; j < 3; ++j)
+    {
+      const auto id = m_vertexIds[3*best + j];
+      auto begin = adjacency.begin() + offsets[id];
+      std::remove(begin, begin + remaining[id], static_cast<unsigned int>(best));
+      --remaining[id];
+    }
+    for(auto id: cache)
+    {
+      if(std::find(next.begin(), next.end(), id) == next.end()) next.push_back(id);
+    }
+
+    for(auto id: cache) position[id] = -1;
+    if(next.size() > cacheSize) next.resize(cacheSize);
+
+    // scores of the vertices in the cache and of the vertices pushed out of it.
+    for(unsigned int i = 0; i < next.size(); ++i) position[next[i]] = i;
+    for(auto id: cache) score[id] = vertexScore(position[id], remaining[id]);
+    for(auto id: next)  score[id] = vertexScore(position[id], remaining[id]);
+
+    for(auto id: cache)
+    {
+      if(position[id] >= 0) continue;
+
+      for(unsigned int i = offsets[id]; i < offsets[id] + remaining[id]; ++i)
+      {
+        updateScore(adjacency[i]);
+      }
+    }
+    cache.swap(next);
+
+    // the next face is the best one using the vertices in the cache.
+    best = -1;
+    float bestScore = -1.f;
+    for(auto id: cache)
+    {
+      for(unsigned int i = offsets[id]; i < offsets[id] + remaining[id]; ++i)
+      {
+        const auto f = adjacency[i];
+        updateScore(f);
+        if(faceScore[f] > bestScore)
+        {
+          bestScore = faceScore[f];
+          best      = f;
+        }
+      }
+    }
+  }
+
+  auto reorder = [&order](std::vector<unsigned int> &ids)
+  {
+    if(ids.empty()) return;
+
+    std::vector<unsigned int> result(ids.size());
+    for(unsigned long f = 0; f < order.size(); ++f)
+    {
+      std::copy_n(ids.begin() + 3*order[f], 3, result.begin() + 3*f);
+    }
+    ids.swap(result);
+  };
+
+  reorder(m_vertexIds);
+  reorder(m_uvIds);
+  reorder(m_normalIds);
+}
+
+//--------------------------------------------------------------------
+Images::Color Mesh::getDiffuse(const float u, const float v) const
+{
+  const auto texture = m_textures->diffuse.get();
+  assert(texture);
   return texture->get(u*(texture->getWidth()-1), v*(texture->getHeight()-1));
 }
 
 //--------------------------------------------------------------------
-Vector3f Mesh::getNormalMap(const float u, const float v)
+Vector3f Mesh::getNormalMap(const float u, const float v) const
 {
-  auto texture = m_material->getTexture(m_mtl, Material::TYPE::NORMAL);
+  const auto texture = m_textures->normal.get();
+  assert(texture);
   auto texColor = texture->get(u*(texture->getWidth()-1), v*(texture->getHeight()-1));
   Vector4f vector{texColor.r, texColor.g, texColor.b, texColor.a};
 
@@ -98,18 +324,20 @@ Vector3f Mesh::getNormalMap(const float u, const float v)
 }
 
 //--------------------------------------------------------------------
-float Mesh::getSpecular(const float u, const float v)
+float Mesh::getSpecular(const float u, const float v) const
 {
-  auto texture = m_material->getTexture(m_mtl, Material::TYPE::SPECULAR);
+  const auto texture = m_textures->specular.get();
+  assert(texture);
   auto color = texture->get(u*(texture->getWidth()-1), v*(texture->getHeight()-1));
 
   return color.raw[0]/1.f;
 }
 
 //--------------------------------------------------------------------
-Vector3f Mesh::getTangent(const float u, const float v)
+Vector3f Mesh::getTangent(const float u, const float v) const
 {
-  auto texture = m_material->getTexture(m_mtl, Material::TYPE::NORMALTS);
+  const auto texture = m_textures->tangent.get();
+  assert(texture);
   auto color = texture->get(u*(texture->getWidth()-1), v*(texture->getHeight()-1));
   assert(color.bytespp >= 3);
 
@@ -120,19 +348,27 @@ Vector3f Mesh::getTangent(const float u, const float v)
 }
 
 //--------------------------------------------------------------------
-Images::Color Mesh::getGlow(const float u, const float v)
+Images::Color Mesh::getGlow(const float u, const float v) const
 {
-  auto texture = m_material->getTexture(m_mtl, Material::TYPE::GLOW);
+  const auto texture = m_textures->glow.get();
+  assert(texture);
   return texture->get(u*(texture->getWidth()-1), v*(texture->getHeight()-1));
 }
 
 //--------------------------------------------------------------------
-Images::Color Mesh::getSSS(const float u, const float v)
+Images::Color Mesh::getSSS(const float u, const float v) const
 {
-  auto texture = m_material->getTexture(m_mtl, Material::TYPE::SSS);
+  const auto texture = m_textures->sss.get();
+  assert(texture);
   return texture->get(u*(texture->getWidth()-1), v*(texture->getHeight()-1));
 }
 
+//--------------------------------------------------------------------
+void Mesh::resolveTextures()
+{
+  m_textures = m_material ? &m_material->getTextures(m_mtl) : &NO_TEXTURES;
+}
+
 //--------------------------------------------------------------------
 std::shared_ptr<Material> parseMaterials(const std::string &filename)
 {
@@ -243,7 +479,7 @@ std::shared_ptr<Material> parseMaterials(const std::string &filename)
 }
 
 //--------------------------------------------------------------------
-std::shared_ptr<Wavefront> Wavefront::read(const std::string& filename)
+std::shared_ptr<Wavefront> Wavefront::read(const std::string& filename, const bool weld)
 {
   auto object = std::shared_ptr<Wavefront>{new Wavefront(filename)};
   std::string mtllib;
@@ -258,6 +494,7 @@ std::shared_ptr<Wavefront> Wavefront::read(const std::string& filename)
   if (!in.fail())
   {
     std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>(std::to_string(id++));
+    std::vector<unsigned int> vIds, tIds, nIds;
 
     std::string line;
     while (!in.eof())
@@ -314,18 +551,29 @@ std::shared_ptr<Wavefront> Wavefront::read(const std::string& filename)
 
       if (!line.compare(0, 2, "f "))
       {
-        Mesh::Face f;
+        vIds.clear();
+        tIds.clear();
+        nIds.clear();
+
         long int vIdx, tIdx, nIdx;
         iss >> trash;
         while (iss >> vIdx >> trash >> tIdx >> trash >> nIdx)
         {
           // in wavefront obj all indices start at 1, not zero
-          f._vertex.push_back(std::abs(vIdx) - vNum - 1);
-          f._uv.push_back(std::abs(tIdx) - uvNum - 1);
-          f._normal.push_back(std::abs(nIdx) - nNum - 1);
+          vIds.push_back(std::abs(vIdx) - vNum - 1);
+          tIds.push_back(std::abs(tIdx) - uvNum - 1);
+          nIds.push_back(std::abs(nIdx) - nNum - 1);
         }
 
-        mesh->addFace(f);
+        // polygons are stored as a fan of triangles.
+        for(unsigned int i = 2; i < vIds.size(); ++i)
+        {
+          const unsigned int v[3]{vIds[0], vIds[i-1], vIds[i]};
+          const unsigned int t[3]{tIds[0], tIds[i-1], tIds[i]};
+          const unsigned int n[3]{nIds[0], nIds[i-1], nIds[i]};
+
+          mesh->addFace(v, t, n);
+        }
         continue;
       }
 
@@ -370,6 +618,8 @@ std::shared_ptr<Wavefront> Wavefront::read(const std::string& filename)
   std::cout << "processed: " << filename << std::endl;
   if(object->m_meshes.size() != 0)
   {
+    object->m_mtllib = mtllib;
+
     if(mtllib != std::string())
     {
       auto pos = filename.find_last_of('/');
@@ -389,17 +639,48 @@ std::shared_ptr<Wavefront> Wavefront::read(const std::string& filename)
 
     std::cout << "number of meshes: " << object->m_meshes.size() << std::endl;
 
+    unsigned long faces = 0;
+    unsigned long bytes = 0;
+    unsigned long corners = 0;
+    unsigned long attributes = 0;
+    unsigned long welded = 0;
     for(auto mesh: object->m_meshes)
     {
+      mesh->m_vertexIds.shrink_to_fit();
+      mesh->m_uvIds.shrink_to_fit();
+      mesh->m_normalIds.shrink_to_fit();
+
+      if(weld)
+      {
+        corners    += mesh->m_vertexIds.size();
+        attributes += mesh->m_vertices.size() + mesh->m_uv.size() + mesh->m_normals.size();
+        mesh->weld();
+        welded     += mesh->m_vertices.size();
+      }
+
+      faces += mesh->faces_num();
+      bytes += mesh->indexBytes();
+
       std::cout << "mesh id: " << mesh->id();
 
       if(object->m_material != nullptr)
       {
         std::cout << " material: " << mesh->materialId() << " textures: " << (mesh->hasDiffuse() ? "D" : "") << (mesh->hasSpecular() ? "S" : "") << (mesh->hasNormalMap() ? "N" : "") << (mesh->hasTangent() ? "T" : "");
       }
-      std::cout << " vertices: " << mesh->m_vertices.size() << " faces: " << mesh->m_faces.size();
+      std::cout << " vertices: " << mesh->m_vertices.size() << " faces: " << mesh->faces_num();
       std::cout << " uv: " << mesh->m_uv.size() << " normals: " << mesh->m_normals.size() << std::endl;
     }
+
+    if(faces != 0)
+    {
+      std::cout << "face indexes: " << bytes << " bytes, " << static_cast<double>(bytes) / faces << " bytes per face." << std::endl;
+    }
+
+    if(weld && welded != 0)
+    {
+      std::cout << "welded vertices: " << welded << " from " << corners << " face corners (" << static_cast<double>(corners) / welded << " corners per vertex), ";
+      std::cout << attributes << " obj attributes before welding." << std::endl;
+    }
   }
   else
   {
@@ -420,6 +701,17 @@ bool Wavefront::write(const std::string &filename)
 
   std::cout << "write: " << filename << std::endl;
 
+  // enough digits to read the same values back.
+  out.precision(std::numeric_limits<float>::max_digits10);
+
+  if(!m_mtllib.empty())
+  {
+    out << "mtllib " << m_mtllib << std::endl << std::endl;
+  }
+
+  // in wavefront obj the indices start at 1 and continue through the meshes.
+  unsigned long vNum = 1, uvNum = 1, nNum = 1;
+
   for(auto mesh: m_meshes)
   {
     out << "# mesh " << mesh->id() << std::endl;
@@ -435,7 +727,7 @@ bool Wavefront::write(const std::string &filename)
     out << "# vt list" << std::endl;
     for(auto t: mesh->m_uv)
     {
-      out << "vt  " << t[0] << " " << t[1] << " " << t[2] << std::endl;
+      out << "vt  " << t[0] << " " << t[1] << std::endl;
     }
     out << std::endl;
 
@@ -447,12 +739,12 @@ bool Wavefront::write(const std::string &filename)
     out << std::endl;
 
     out << "# faces list" << std::endl;
-    for(auto f: mesh->m_faces)
+    for(unsigned long f = 0; f < mesh->faces_num(); ++f)
     {
       out << "f ";
-      for(unsigned int i = 0; i < f._vertex.size(); ++i)
+      for(unsigned int i = 0; i < 3; ++i)
       {
-        out << f._vertex[i] << "/" << f._uv[i] << " " << f._normal[i] << (i == f._vertex.size()-1 ? "" : " ");
+        out << mesh->getFaceVertexIds(f)[i] + vNum << "/" << mesh->getFaceUVIds(f)[i] + uvNum << "/" << mesh->getFaceNormals(f)[i] + nNum << (i == 2 ? "" : " ");
       }
       out << std::endl;
     }
@@ -466,8 +758,12 @@ bool Wavefront::write(const std::string &filename)
 
     out << std::endl;
 
+    vNum  += mesh->m_vertices.size();
+    uvNum += mesh->m_uv.size();
+    nNum  += mesh->m_normals.size();
+
     std::cout << "mesh id: " << mesh->id() << " material: " << (mesh->materialId() == std::string() ? "none":mesh->materialId());
-    std::cout << " vertices: " << mesh->m_vertices.size() << " faces: " << mesh->m_faces.size() << std::endl;
+    std::cout << " vertices: " << mesh->m_vertices.size() << " faces: " << mesh->faces_num() << std::endl;
   }
 
   std::cout << std::flush;
@@ -489,11 +785,39 @@ void Wavefront::setMaterial(std::shared_ptr<Material> material)
   }
 }
 
+//--------------------------------------------------------------------
+void Wavefront::optimize()
+{
+  std::cout << "optimize faces order, cache size: " << Mesh::CACHE_SIZE << std::endl;
+
+  unsigned long faces = 0;
+  double before = 0, after = 0;
+  for(auto mesh: m_meshes)
+  {
+    const auto acmr = mesh->acmr();
+    mesh->optimizeFaces();
+
+    faces  += mesh->faces_num();
+    before += acmr * mesh->faces_num();
+    after  += mesh->acmr() * mesh->faces_num();
+
+    std::cout << "mesh id: " << mesh->id() << " faces: " << mesh->faces_num() << " ACMR: " << acmr << " -> " << mesh->acmr() << std::endl;
+  }
+
+  if(faces != 0)
+  {
+    std::cout << "ACMR: " << before / faces << " -> " << after / faces << std::endl;
+  }
+  std::cout << std::flush;
+}
+
 //--------------------------------------------------------------------
 void Material::addTexture(const std::string &filename, const std::shared_ptr<Images::Image> texture)
 {
   texture->flipVertically();
   m_textures[filename] = texture;
+
+  for(auto &resolved: m_resolved) resolveTextures(resolved.first, resolved.second);
 }
 
 //--------------------------------------------------------------------
@@ -505,6 +829,9 @@ void Material::addProperty(const std::string& materialId, const std::string& key
 void Material::addMaterialTexture(const std::string &materialId, const TYPE type, const std::string &textureId)
 {
   m_materials[materialId][static_cast<int>(type)] = textureId;
+
+  auto it = m_resolved.find(materialId);
+  if(it != m_resolved.end()) resolveTextures(materialId, (*it).second);
 }
 
 //--------------------------------------------------------------------
@@ -512,7 +839,7 @@ std::shared_ptr<Images::Image> Material::getTexture(const std::string& id, const
 {
   assert(m_materials.find(id) != m_materials.end());
 
-  auto map = m_materials.at(id);
+  const auto &map = m_materials.at(id);
 
   assert(map.find(static_cast<int>(type)) != map.end());
 
@@ -524,7 +851,7 @@ const Vector3f Material::getProperty(const std::string& id, const std::string& k
 {
   assert(m_properties.find(id) != m_properties.end());
 
-  auto map = m_properties.at(id);
+  const auto &map = m_properties.at(id);
 
   assert(map.find(key) != map.end());
 
@@ -538,7 +865,42 @@ bool Material::hasTexture(const std::string &materialId, const TYPE type) const
 
   if(it == m_materials.end()) return false;
 
-  auto map = (*it).second;
+  const auto &map = (*it).second;
 
   return (map.find(static_cast<int>(type)) != map.end());
 }
+
+//--------------------------------------------------------------------
+const Material::Textures &Material::getTextures(const std::string &materialId)
+{
+  auto it = m_resolved.find(materialId);
+
+  if(it == m_resolved.end())
+  {
+    it = m_resolved.emplace(materialId, Textures()).first;
+    resolveTextures(materialId, (*it).second);
+  }
+
+  // elements of an unordered_map are not moved by rehashing, so the reference stays valid.
+  return (*it).second;
+}
+
+//--------------------------------------------------------------------
+void Material::resolveTextures(const std::string &materialId, Textures &textures) const
+{
+  auto texture = [this, &materialId](const TYPE type) -> std::shared_ptr<Images::Image>
+  {
+    if(!hasTexture(materialId, type)) return nullptr;
+
+    auto it = m_textures.find(m_materials.at(materialId).at(static_cast<int>(type)));
+
+    return it == m_textures.end() ? nullptr : (*it).second;
+  };
+
+  textures.diffuse  = texture(TYPE::DIFFUSE);
+  textures.normal   = texture(TYPE::NORMAL);
+  textures.tangent  = texture(TYPE::NORMALTS);
+  textures.specular = texture(TYPE::SPECULAR);
+  textures.glow     = texture(TYPE::GLOW);
+  textures.sss      = texture(TYPE::SSS);
+}
@@ -22,10 +22,55 @@
 #include <Images.h>
 #include <Mesh.h>
 
+// C++
+#include <cmath>
+
 using namespace Images;
 
 auto minmax01 = [](float value) { return std::min(1.f, std::max(0.f, value)); };
 
+//--------------------------------------------------------------------
+/** \brief Computes the parts of the tangent basis of the triangle that are the same for all its fragments.
+ *  The basis is the inverse of the matrix with rows [p1-p0, p2-p0, n] applied to the texture coordinate
+ *  differences, that is (U^n, V^n)/((p1-p0)^(p2-p0)*n).
+ * \param[in] vertices triangle vertices in homogeneous coordinates.
+ * \param[in] uv triangle texture coordinates.
+ * \param[out] tangent U vector.
+ * \param[out] bitangent V vector.
+ * \param[out] faceNormal triangle normal.
+ *
+ */
+void tangentSetup(const Matrix<float,3,4> &vertices, const Vector2f *uv, Vector3f &tangent, Vector3f &bitangent, Vector3f &faceNormal)
+{
+  const Vector3f e1 = vertices[1].project() - vertices[0].project();
+  const Vector3f e2 = vertices[2].project() - vertices[0].project();
+
+  tangent    = e2 * (uv[1][0] - uv[0][0]) - e1 * (uv[2][0] - uv[0][0]);
+  bitangent  = e2 * (uv[1][1] - uv[0][1]) - e1 * (uv[2][1] - uv[0][1]);
+  faceNormal = e1 ^ e2;
+}
+
+//--------------------------------------------------------------------
+/** \brief Returns the tangent basis of a fragment with the values computed by tangentSetup().
+ * \param[in] normal normalized fragment normal.
+ * \param[in] tangent U vector.
+ * \param[in] bitangent V vector.
+ * \param[in] faceNormal triangle normal.
+ *
+ */
+Matrix3f tangentBasis(const Vector3f &normal, const Vector3f &tangent, const Vector3f &bitangent, const Vector3f &faceNormal)
+{
+  // only the sign of the determinant survives the normalization.
+  const auto sign = (faceNormal * normal) < 0 ? -1.f : 1.f;
+
+  Matrix3f B;
+  B.setColumn(0, ((tangent ^ normal) * sign).normalize());
+  B.setColumn(1, ((bitangent ^ normal) * sign).normalize());
+  B.setColumn(2, normal);
+
+  return B;
+}
+
 //--------------------------------------------------------------------
 Vector4f GouraudShader::vertex(int iface, int nthvert)
 {
@@ -237,32 +282,27 @@ Vector4f DarbouxNormalShader::vertex(int iface, int nthvert)
 }
 
 //--------------------------------------------------------------------
-bool DarbouxNormalShader::fragment(Vector3f baricentric, Images::Color& color)
+void DarbouxNormalShader::setup()
 {
-  const auto nb = (varying_normals * baricentric).normalize();
-
-  auto uv0 = uniform_mesh->getuv(varying_uv_index[0]);
-  auto uv1 = uniform_mesh->getuv(varying_uv_index[1]);
-  auto uv2 = uniform_mesh->getuv(varying_uv_index[2]);
-
-  auto uv = (uv0 * baricentric[0]) + (uv1 * baricentric[1]) + (uv2 * baricentric[2]);
+  for(int i = 0; i < 3; ++i)
+  {
+    varying_uv[i] = uniform_mesh->getuv(varying_uv_index[i]);
+    varying_screen.setColumn(i, (ViewPort * varying_vertex[i]).project());
+  }
 
-  Matrix3f A;
-  A[0] = varying_vertex[1].project() - varying_vertex[0].project();
-  A[1] = varying_vertex[2].project() - varying_vertex[0].project();
-  A[2] = nb;
+  tangentSetup(varying_vertex, varying_uv, varying_tangent, varying_bitangent, varying_faceNormal);
+}
 
-  auto AI = A.inverse();
+//--------------------------------------------------------------------
+bool DarbouxNormalShader::fragment(Vector3f baricentric, Images::Color& color)
+{
+  const auto nb = (varying_normals * baricentric).normalize();
 
-  auto i = AI * Vector3f{uv1[0] - uv0[0], uv2[0] - uv0[0], 0.f};
-  auto j = AI * Vector3f{uv1[1] - uv0[1], uv2[1] - uv0[1], 0.f};
+  const Vector2f uv = (varying_uv[0] * baricentric[0]) + (varying_uv[1] * baricentric[1]) + (varying_uv[2] * baricentric[2]);
 
-  Matrix3f B;
-  B.setColumn(0, i.normalize());
-  B.setColumn(1, j.normalize());
-  B.setColumn(2, nb);
+  const auto B = tangentBasis(nb, varying_tangent, varying_bitangent, varying_faceNormal);
 
-  const auto l       = (uniform_transform * Light.augment(0)).project(false).normalize();
+  const auto &l      = uniform_light;
   const auto n       = (uniform_transform_TI * (B * uniform_mesh->getTangent(uv)).augment(0)).project(false).normalize();
   const auto diffuse = minmax01(n*l);
   auto specular      = 0.f;
@@ -278,12 +318,7 @@ bool DarbouxNormalShader::fragment(Vector3f baricentric, Images::Color& color)
     specular = minmax01(std::pow(base, exp));
   }
 
-  Matrix3f transformed;
-  for(int i = 0; i < 3; ++i)
-  {
-    transformed[i] = (ViewPort * varying_vertex[i]).project();
-  }
-  auto vertex = transformed.transpose() * baricentric;
+  auto vertex = varying_screen * baricentric;
 
   auto x = static_cast<unsigned short>(vertex[0]);
   auto y = static_cast<unsigned short>(vertex[1]);
@@ -354,51 +389,99 @@ Vector4f FinalShader::vertex(int iface, int nthvert)
 
   varying_uv_index[nthvert] = uniform_mesh->getFaceUVIds(iface)[nthvert];
   varying_vertex[nthvert]   = (uniform_transform * vertex);
+  varying_screen[nthvert]   = (ViewPort * varying_vertex[nthvert]);
   varying_normals.setColumn(nthvert, (uniform_transform_TI * uniform_mesh->getNormal(normalId).augment(0)).project(false));
-  varying_dVertex.setColumn(nthvert, (uniform_transform_S * vertex).project());
+  varying_dVertex[nthvert]  = (uniform_transform_S * vertex);
 
   return varying_vertex[nthvert];
 }
 
+//--------------------------------------------------------------------
+void FinalShader::setup()
+{
+  for(int i = 0; i < 3; ++i)
+  {
+    varying_uv[i] = uniform_mesh->getuv(varying_uv_index[i]);
+  }
+
+  if(uniform_mesh->hasTangent())
+  {
+    tangentSetup(varying_vertex, varying_uv, varying_tangent, varying_bitangent, varying_faceNormal);
+  }
+}
+
 //--------------------------------------------------------------------
 bool FinalShader::fragment(Vector3f baricentric, Images::Color& color)
 {
-  const auto nb = (varying_normals * baricentric).normalize();
+  Vector2f uv;
+  Vector3f n;
 
-  auto uv0 = uniform_mesh->getuv(varying_uv_index[0]);
-  auto uv1 = uniform_mesh->getuv(varying_uv_index[1]);
-  auto uv2 = uniform_mesh->getuv(varying_uv_index[2]);
+  if(!surface(baricentric, uv, n)) return true;
 
-  auto uv = (uv0 * baricentric[0]) + (uv1 * baricentric[1]) + (uv2 * baricentric[2]);
+  // the baricentric coordinates are perspective correct, the homogeneous coordinates are interpolated
+  // and divided afterwards to get the pixel of the fragment and its point in the light depth buffer.
+  const Vector4f screen = varying_screen[0] * baricentric[0] + varying_screen[1] * baricentric[1] + varying_screen[2] * baricentric[2];
+  varying_ambient_value = ambient(std::lround(screen[0] / screen[3]), std::lround(screen[1] / screen[3]));
 
-  if(uv[0] > 1 || uv[0] < 0 || uv[1] > 1 || uv[1] < 0) return true;
+  const Vector4f dVertex = varying_dVertex[0] * baricentric[0] + varying_dVertex[1] * baricentric[1] + varying_dVertex[2] * baricentric[2];
 
-  const auto l = (uniform_transform * Light.augment(0)).project(false).normalize();
-  auto n = nb;
-  color = uniform_mesh->getDiffuse(uv);
-  float diffuse = 1.0;
-  float specular = 0.0;
+  return light(uv, n, varying_ambient_value, shadow(dVertex.project()), color);
+}
+
+//--------------------------------------------------------------------
+bool FinalShader::surface(const Vector3f &baricentric, Vector2f &uv, Vector3f &normal)
+{
+  const auto nb = (varying_normals * baricentric).normalize();
+
+  uv = (varying_uv[0] * baricentric[0]) + (varying_uv[1] * baricentric[1]) + (varying_uv[2] * baricentric[2]);
+
+  if(uv[0] > 1 || uv[0] < 0 || uv[1] > 1 || uv[1] < 0) return false;
+
+  normal = nb;
 
   if(uniform_mesh->hasTangent())
   {
-    Matrix3f A;
-    A[0] = varying_vertex[1].project() - varying_vertex[0].project();
-    A[1] = varying_vertex[2].project() - varying_vertex[0].project();
-    A[2] = nb;
+    const auto B = tangentBasis(nb, varying_tangent, varying_bitangent, varying_faceNormal);
+
+    normal = (uniform_transform_TI * (B * uniform_mesh->getTangent(uv)).augment(0)).project(false).normalize();
+  }
+
+  return true;
+}
 
-    auto AI = A.inverse();
+//--------------------------------------------------------------------
+float FinalShader::shadow(const Vector3f &vertex)
+{
+  const auto x = static_cast<unsigned short>(vertex[0]);
+  const auto y = static_cast<unsigned short>(vertex[1]);
 
-    auto i = AI * Vector3f{uv1[0] - uv0[0], uv2[0] - uv0[0], 0.f};
-    auto j = AI * Vector3f{uv1[1] - uv0[1], uv2[1] - uv0[1], 0.f};
+  if(0 <= x && x < uniform_depthBuffer->getWidth() && 0 <= y && y < uniform_depthBuffer->getHeight() && uniform_depthBuffer->get(x,y) > vertex[2]+43.34)
+  {
+    return uniform_shadow_coeff;
+  }
 
-    Matrix3f B;
-    B.setColumn(0, i.normalize());
-    B.setColumn(1, j.normalize());
-    B.setColumn(2, nb);
+  return 1.0;
+}
 
-    n = (uniform_transform_TI * (B * uniform_mesh->getTangent(uv)).augment(0)).project(false).normalize();
+//--------------------------------------------------------------------
+int FinalShader::ambient(const int x, const int y) const
+{
+  if(0 <= x && x < uniform_ambient_image->getWidth() && 0 <= y && y < uniform_ambient_image->getHeight())
+  {
+    return uniform_ambient_image->get(x,y).raw[0];
   }
 
+  return 15;
+}
+
+//--------------------------------------------------------------------
+bool FinalShader::light(const Vector2f &uv, const Vector3f &n, const int ambient_value, const float shadow_coeff, Images::Color &color)
+{
+  const auto &l = uniform_light;
+  color = uniform_mesh->getDiffuse(uv);
+  float diffuse = 1.0;
+  float specular = 0.0;
+
   diffuse = minmax01(n*l);
 
   if(color.bytespp == 4 && color.a == 0) return true;
@@ -411,32 +494,8 @@ bool FinalShader::fragment(Vector3f baricentric, Images::Color& color)
     specular = minmax01(std::pow(base, exp));
   }
 
-  Matrix3f vm;
-  for(int i = 0; i < 3; ++i) vm.setColumn(i, varying_vertex[i].project());
-  auto vertex = (vm * baricentric);
-  auto x = static_cast<unsigned short>(vertex[0]);
-  auto y = static_cast<unsigned short>(vertex[1]);
-  if(0 <= x && x < uniform_ambient_image->getWidth() && 0 <= y && y < uniform_ambient_image->getHeight())
-  {
-    varying_ambient_value = uniform_ambient_image->get(x,y).raw[0];
-  }
-  else
-  {
-    varying_ambient_value = 15;
-  }
-
-  vertex = varying_dVertex * baricentric;
-  x = static_cast<unsigned short>(vertex[0]);
-  y = static_cast<unsigned short>(vertex[1]);
-
-  float shadow_coeff = 1.0;
-  if(0 <= x && x < uniform_depthBuffer->getWidth() && 0 <= y && y < uniform_depthBuffer->getHeight() && uniform_depthBuffer->get(x,y) > vertex[2]+43.34)
-  {
-    shadow_coeff = uniform_shadow_coeff;
-  }
-
   auto light_coeff = uniform_diffuse_coeff*diffuse + uniform_specular_coeff*specular;
-  auto ambient = uniform_ambient_coeff*varying_ambient_value;
+  auto ambient = uniform_ambient_coeff*ambient_value;
   color = (color * light_coeff * shadow_coeff) + ambient;
 
   if(uniform_mesh->hasGlow())
@@ -35,6 +35,9 @@ struct GouraudShader
     virtual Vector4f vertex(int iface, int nthvert);
     virtual bool fragment(Vector3f baricentric, Images::Color &color);
 
+    virtual bool clipTransform(Matrix4f &matrix) const override
+    { matrix = uniform_transform; return true; }
+
     Vector3f       varying_intensity;
     const Matrix4f uniform_transform    = Projection*ModelView;
     const Matrix4f uniform_transform_TI = (Projection*ModelView).transpose().inverse();
@@ -44,7 +47,7 @@ struct GouraudShader
  * \brief Implements Gouraud shading without textures
  *
  */
-struct CellShader
+struct CellShader final
 : public GouraudShader
 {
     virtual bool fragment(Vector3f baricentric, Images::Color &color) override;
@@ -57,11 +60,26 @@ struct CellShader
  * \brief Use of multiple shaders for image generation.
  *
  */
-struct MultiShader
+struct MultiShader final
 : public GL_Impl::Shader
 {
+    MultiShader() = default;
+
+    // owns the added shaders.
+    MultiShader(const MultiShader &) = delete;
+    MultiShader &operator=(const MultiShader &) = delete;
+
     virtual Vector4f vertex(int iface, int nthvert);
 
+    virtual void setup() override
+    { for(auto shader: uniform_shaders) shader->setup(); }
+
+    virtual void setMesh(Mesh *mesh) override
+    {
+      uniform_mesh = mesh;
+      for(auto shader: uniform_shaders) shader->setMesh(mesh);
+    }
+
     virtual bool fragment(Vector3f baricentric, Images::Color &color);
 
     Vector3f              varying_intensity; // written by vertex shader, read by fragment shader
@@ -80,7 +98,7 @@ struct MultiShader
 
     void addShader(Shader *shader)
     {
-      shader->uniform_mesh = uniform_mesh;
+      shader->setMesh(uniform_mesh);
 
       uniform_shaders.push_back(shader);
     }
@@ -104,7 +122,7 @@ struct TexturedGouraudShader
  * \brief Implements normal mapping with normal textures.
  *
  */
-struct NormalMapping
+struct NormalMapping final
 : public TexturedGouraudShader
 {
     virtual bool fragment(Vector3f baricentric, Images::Color &color);
@@ -124,7 +142,7 @@ struct TexturedNormalMapping
  * \brief Adds specular mapping computation to previous shader.
  *
  */
-struct TexturedSpecularShader
+struct TexturedSpecularShader final
 : public TexturedNormalMapping
 {
     virtual bool fragment(Vector3f baricentric, Images::Color &color);
@@ -139,7 +157,7 @@ struct TexturedSpecularShader
  * \brief Implements phong shading.
  *
  */
-struct PhongShader
+struct PhongShader final
 : public GouraudShader
 {
     virtual Vector4f vertex(int iface, int nthvert);
@@ -159,8 +177,13 @@ struct DarbouxNormalShader
 {
     virtual Vector4f vertex(int iface, int nthvert);
 
+    virtual void setup() override;
+
     virtual bool fragment(Vector3f baricentric, Images::Color &color);
 
+    virtual bool clipTransform(Matrix4f &matrix) const override
+    { matrix = uniform_transform; return true; }
+
     float          uniform_glow_coeff     = 1.0; // glow coefficient.
     float          uniform_specular_coeff = 0.4; // specular coefficient.
     float          uniform_diffuse_coeff  = 0.5; // diffuse coefficient.
@@ -169,8 +192,14 @@ struct DarbouxNormalShader
     Vector3i       varying_uv_index;       // uv_indexes
     Matrix3f       varying_normals;        // normals indexes.
     Matrix<float, 3,4> varying_vertex;         // triangle in Projection*Modelview
+    Vector2f       varying_uv[3];          // texture coordinates of the triangle vertices.
+    Vector3f       varying_tangent;        // tangent and bitangent of the triangle before the
+    Vector3f       varying_bitangent;      // cross product with the normal of the fragment.
+    Vector3f       varying_faceNormal;     // triangle normal.
+    Matrix3f       varying_screen;         // triangle in screen space, a vertex per column.
     const Matrix4f uniform_transform    = Projection*ModelView;
     const Matrix4f uniform_transform_TI = (Projection*ModelView).transpose().inverse();
+    const Vector3f uniform_light        = (uniform_transform * Light.augment(0)).project(false).normalize(); // light direction in Projection*Modelview.
     int            varying_ambient_value;
     std::shared_ptr<Images::Image> uniform_ambient_image;
 };
@@ -179,7 +208,7 @@ struct DarbouxNormalShader
  * \brief Computes the transformed coordinates but does nothing else. Used to compute depth buffers.
  *
  */
-struct EmptyShader
+struct EmptyShader final
 : public GL_Impl::Shader
 {
     virtual Vector4f vertex(int iface, int nthvert);
@@ -187,6 +216,9 @@ struct EmptyShader
     virtual bool fragment(Vector3f baricentric, Images::Color &color)
     { return true; }
 
+    virtual bool clipTransform(Matrix4f &matrix) const override
+    { matrix = uniform_transform; return true; }
+
     Matrix4f uniform_transform = Projection*ModelView; // transformation matrix.
 };
 
@@ -194,7 +226,7 @@ struct EmptyShader
  * \brief Adds shadows computation to Darboux shader using a depth buffer computed from the light position.
  *
  */
-struct HardShadowsShader
+struct HardShadowsShader final
 : public DarbouxNormalShader
 {
     virtual Vector4f vertex(int iface, int nthvert);
@@ -210,13 +242,51 @@ struct HardShadowsShader
  * \brief Computes the final image using all the shaders developed in the course.
  *
  */
-struct FinalShader
+struct FinalShader final
 : public GL_Impl::Shader
 {
     virtual Vector4f vertex(int iface, int nthvert);
 
+    virtual void setup() override;
+
     virtual bool fragment(Vector3f baricentric, Images::Color &color);
 
+    virtual bool clipTransform(Matrix4f &matrix) const override
+    { matrix = uniform_transform; return true; }
+
+    /** \brief Computes the texture coordinates and the normal of the surface at the given point of the
+     *  current face, setup() must have been called for it. Returns false if the texture coordinates are
+     *  out of the texture.
+     * \param[in] baricentric baricentric coordinates of the point.
+     * \param[out] uv texture coordinates.
+     * \param[out] normal surface normal in Projection*ModelView space.
+     *
+     */
+    bool surface(const Vector3f &baricentric, Vector2f &uv, Vector3f &normal);
+
+    /** \brief Returns the shadow coefficient of the given point.
+     * \param[in] vertex point coordinates in the light depth buffer space.
+     *
+     */
+    float shadow(const Vector3f &vertex);
+
+    /** \brief Returns the ambient occlusion value of the given pixel, or 15 if it's out of the ambient image.
+     * \param[in] x pixel x coordinate.
+     * \param[in] y pixel y coordinate.
+     *
+     */
+    int ambient(const int x, const int y) const;
+
+    /** \brief Computes the color of a point of the current mesh. Returns true if the point must be discarded.
+     * \param[in] uv texture coordinates.
+     * \param[in] n surface normal in Projection*ModelView space.
+     * \param[in] ambient_value ambient occlusion value.
+     * \param[in] shadow_coeff shadow coefficient of the point.
+     * \param[out] color point color.
+     *
+     */
+    bool light(const Vector2f &uv, const Vector3f &n, const int ambient_value, const float shadow_coeff, Images::Color &color);
+
     float          uniform_glow_coeff     = 1.0; // glow coefficient.
     float          uniform_specular_coeff = 0.3; // specular coefficient.
     float          uniform_diffuse_coeff  = 0.6; // diffuse coefficient.
@@ -226,9 +296,15 @@ struct FinalShader
     Vector3i       varying_uv_index; // uv_indexes
     Matrix3f       varying_normals;  // normals indexes.
     Matrix<float, 3,4> varying_vertex;   // triangle in Projection*Modelview
-    Matrix3f       varying_dVertex;  // triangle in light projection.
+    Matrix<float, 3,4> varying_screen;   // triangle in ViewPort*Projection*Modelview, before the perspective division.
+    Matrix<float, 3,4> varying_dVertex;  // triangle in light projection, before the perspective division.
+    Vector2f       varying_uv[3];      // texture coordinates of the triangle vertices.
+    Vector3f       varying_tangent;    // tangent and bitangent of the triangle before the
+    Vector3f       varying_bitangent;  // cross product with the normal of the fragment.
+    Vector3f       varying_faceNormal; // triangle normal.
     const Matrix4f uniform_transform    = Projection*ModelView;
     const Matrix4f uniform_transform_TI = (Projection*ModelView).transpose().inverse();
+    const Vector3f uniform_light        = (uniform_transform * Light.augment(0)).project(false).normalize(); // light direction in Projection*Modelview.
     Matrix4f       uniform_transform_S; // matrix of the light depth computation.
     int            varying_ambient_value;
     std::shared_ptr<Images::Image>  uniform_ambient_image;
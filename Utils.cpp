@@ -50,13 +50,17 @@ Utils::BlockTimer::~BlockTimer()
 Utils::zBuffer::zBuffer(const short width, const short height)
 : m_width {width}
 , m_height{height}
-, m_min   {std::numeric_limits<float>::max()}
-, m_max   {-std::numeric_limits<float>::max()}
+, m_hValid{false}
 {
   assert(width > 0 && height > 0);
 
   m_data = new float[width*height];
 
+  for(unsigned int level = 0; m_levels.empty() || m_levels.back().size() > 1; ++level)
+  {
+    m_levels.emplace_back(levelWidth(level)*levelHeight(level), -std::numeric_limits<float>::max());
+  }
+
   clear();
 }
 
@@ -64,8 +68,8 @@ Utils::zBuffer::zBuffer(const short width, const short height)
 Utils::zBuffer::zBuffer(const zBuffer& buffer)
 : m_width{buffer.m_width}
 , m_height{buffer.m_height}
-, m_min{buffer.m_min}
-, m_max{buffer.m_max}
+, m_levels{buffer.m_levels}
+, m_hValid{buffer.m_hValid}
 {
   m_data = new float[m_width*m_height];
 
@@ -79,44 +83,66 @@ Utils::zBuffer::~zBuffer()
 }
 
 //--------------------------------------------------------------------
-double Utils::zBuffer::get(const unsigned short x, const unsigned short y)
+double Utils::zBuffer::get(const unsigned short x, const unsigned short y) const
 {
   assert(x < m_width && y < m_height);
-  std::lock_guard<std::mutex> lock(m_mutex);
 
-  return m_data[y*m_width + x];
+  float value;
+  __atomic_load(m_data + y*m_width + x, &value, __ATOMIC_RELAXED);
+
+  return value;
 }
 
 //--------------------------------------------------------------------
 void Utils::zBuffer::set(const unsigned short x, const unsigned short y, double value)
 {
   assert(x < m_width && y < m_height);
-  std::lock_guard<std::mutex> lock(m_mutex);
 
-  if(m_min > value) m_min = value;
-  if(m_max < value) m_max = value;
+  float depth = value;
+  __atomic_store(m_data + y*m_width + x, &depth, __ATOMIC_RELAXED);
 
-  m_data[y*m_width + x] = value;
+  // the value can be farther than the stored one.
+  __atomic_store_n(&m_hValid, false, __ATOMIC_RELAXED);
 }
 
 //--------------------------------------------------------------------
 bool Utils::zBuffer::checkAndSet(const unsigned short x, const unsigned short y, float value)
 {
   assert(x < m_width && y < m_height);
-  std::lock_guard<std::mutex> lock(m_mutex);
 
-  if(m_data[y*m_width + x] < value)
-  {
-    if(m_min > value) m_min = value;
-    if(m_max < value) m_max = value;
+  auto ptr = m_data + y*m_width + x;
+
+  float current;
+  __atomic_load(ptr, &current, __ATOMIC_RELAXED);
 
-    m_data[y*m_width + x] = value;
-    return true;
+  // on failure current gets the value written by the other thread and the test is repeated.
+  while(current < value)
+  {
+    if(__atomic_compare_exchange(ptr, &current, &value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return true;
   }
 
   return false;
 }
 
+//--------------------------------------------------------------------
+void Utils::zBuffer::limits(float &min, float &max) const
+{
+  const auto cleared = -std::numeric_limits<float>::max();
+  const long size    = m_width*m_height;
+
+  min = std::numeric_limits<float>::max();
+  max = cleared;
+
+  // cleared pixels are the lowest value possible, they only need to be skipped for the minimum.
+  #pragma omp parallel for reduction(min:min) reduction(max:max)
+  for(long i = 0; i < size; ++i)
+  {
+    const auto value = m_data[i];
+    min = std::min(min, value > cleared ? value : std::numeric_limits<float>::max());
+    max = std::max(max, value);
+  }
+}
+
 //--------------------------------------------------------------------
 unsigned short Utils::zBuffer::getWidth() const
 {
@@ -132,25 +158,30 @@ unsigned short Utils::zBuffer::getHeight() const
 //--------------------------------------------------------------------
 float Utils::zBuffer::getMinimum() const
 {
-  std::lock_guard<std::mutex> lock(m_mutex);
+  float min, max;
+  limits(min, max);
 
-  return m_min;
+  return min;
 }
 
 //--------------------------------------------------------------------
 float Utils::zBuffer::getMaximum() const
 {
-  std::lock_guard<std::mutex> lock(m_mutex);
+  float min, max;
+  limits(min, max);
 
-  return m_max;
+  return max;
 }
 
 //--------------------------------------------------------------------
 void Utils::zBuffer::write(const std::string& filename)
 {
+  float minimum, maximum;
+  limits(minimum, maximum);
+
   auto image = std::make_shared<Images::TGA>(m_width, m_height, Image::GRAYSCALE);
-  auto min   = std::fabs(m_min);
-  auto delta = 256./(m_max + min);
+  auto min   = std::fabs(minimum);
+  auto delta = 256./(maximum + min);
 
   for(unsigned short x = 0; x < m_width; ++x)
   {
@@ -166,6 +197,45 @@ void Utils::zBuffer::write(const std::string& filename)
   image->write(filename);
 }
 
+const unsigned short Utils::VisibilityBuffer::EMPTY;
+
+//--------------------------------------------------------------------
+Utils::VisibilityBuffer::VisibilityBuffer(const short width, const short height)
+: m_width {width}
+, m_height{height}
+, m_data  (width*height)
+{
+  assert(width > 0 && height > 0);
+
+  clear();
+}
+
+//--------------------------------------------------------------------
+const Utils::VisibilityBuffer::Sample &Utils::VisibilityBuffer::get(const unsigned short x, const unsigned short y) const
+{
+  assert(x < m_width && y < m_height);
+
+  return m_data[y*m_width + x];
+}
+
+//--------------------------------------------------------------------
+void Utils::VisibilityBuffer::set(const unsigned short x, const unsigned short y, const unsigned short mesh, const unsigned int face, const Vector3f &barycentric)
+{
+  assert(x < m_width && y < m_height);
+
+  auto &sample = m_data[y*m_width + x];
+  sample.face           = face;
+  sample.mesh           = mesh;
+  sample.barycentric[0] = barycentric[1];
+  sample.barycentric[1] = barycentric[2];
+}
+
+//--------------------------------------------------------------------
+void Utils::VisibilityBuffer::clear()
+{
+  std::fill(m_data.begin(), m_data.end(), Sample{0, EMPTY, {0, 0}});
+}
+
 //--------------------------------------------------------------------
 bool Utils::dumpTexture(std::shared_ptr<Mesh> mesh, const std::string &filename)
 {
@@ -202,6 +272,87 @@ bool Utils::dumpTexture(std::shared_ptr<Mesh> mesh, const std::string &filename)
 void Utils::zBuffer::clear()
 {
   std::fill_n(m_data, m_width*m_height, -std::numeric_limits<float>::max());
+
+  m_hValid = false;
+}
+
+//--------------------------------------------------------------------
+void Utils::zBuffer::updateHierarchy()
+{
+  const int width  = levelWidth(0);
+  const int height = levelHeight(0);
+
+  #pragma omp parallel for
+  for(int cell = 0; cell < width*height; ++cell)
+  {
+    const int x0 = (cell % width) * BLOCK_SIZE;
+    const int y0 = (cell / width) * BLOCK_SIZE;
+    const int x1 = std::min<int>(x0 + BLOCK_SIZE, m_width);
+    const int y1 = std::min<int>(y0 + BLOCK_SIZE, m_height);
+
+    auto value = std::numeric_limits<float>::max();
+    for(int y = y0; y < y1; ++y)
+    {
+      for(int x = x0; x < x1; ++x)
+      {
+        value = std::min(value, m_data[y*m_width + x]);
+      }
+    }
+
+    m_levels[0][cell] = value;
+  }
+
+  for(unsigned int level = 1; level < m_levels.size(); ++level)
+  {
+    const auto &previous = m_levels[level-1];
+    const int pWidth  = levelWidth(level-1);
+    const int pHeight = levelHeight(level-1);
+    const int lWidth  = levelWidth(level);
+
+    for(unsigned int cell = 0; cell < m_levels[level].size(); ++cell)
+    {
+      const int x = (cell % lWidth) * 2;
+      const int y = (cell / lWidth) * 2;
+
+      auto value = previous[y*pWidth + x];
+      if(x + 1 < pWidth)                     value = std::min(value, previous[y*pWidth + x + 1]);
+      if(y + 1 < pHeight)                    value = std::min(value, previous[(y+1)*pWidth + x]);
+      if(x + 1 < pWidth && y + 1 < pHeight)  value = std::min(value, previous[(y+1)*pWidth + x + 1]);
+
+      m_levels[level][cell] = value;
+    }
+  }
+
+  m_hValid = true;
+}
+
+//--------------------------------------------------------------------
+bool Utils::zBuffer::isOccluded(const Vector2i &min, const Vector2i &max, const float depth) const
+{
+  if(!__atomic_load_n(&m_hValid, __ATOMIC_RELAXED)) return false;
+
+  // finest level where the rectangle spans at most 2x2 cells.
+  unsigned int level = 0;
+  while(level + 1 < m_levels.size())
+  {
+    const int cells = std::max((max[0] / BLOCK_SIZE >> level) - (min[0] / BLOCK_SIZE >> level),
+                               (max[1] / BLOCK_SIZE >> level) - (min[1] / BLOCK_SIZE >> level));
+    if(cells <= 1) break;
+    ++level;
+  }
+
+  const int width = levelWidth(level);
+  for(int y = min[1] / BLOCK_SIZE >> level; y <= max[1] / BLOCK_SIZE >> level; ++y)
+  {
+    for(int x = min[0] / BLOCK_SIZE >> level; x <= max[0] / BLOCK_SIZE >> level; ++x)
+    {
+      // fragments pass the depth test only if they are closer than the stored value, equal
+      // values are kept to not reject the triangles that wrote them.
+      if(m_levels[level][y*width + x] <= depth) return false;
+    }
+  }
+
+  return true;
 }
 
 //--------------------------------------------------------------------
@@ -29,7 +29,7 @@
 #include <chrono>
 #include <memory>
 #include <string>
-#include <mutex>
+#include <vector>
 
 class Mesh;
 
@@ -59,12 +59,13 @@ namespace Utils
        */
       ~zBuffer();
 
-      /** \brief Returns the value at the given coordinates.
+      /** \brief Returns the value at the given coordinates. Lock-free, can be used concurrently with
+       *  the other methods.
        * \param[in] x point x coordinate.
        * \param[in] y point y coordinate.
        *
        */
-      double get(const unsigned short x, const unsigned short y);
+      double get(const unsigned short x, const unsigned short y) const;
 
       /** \brief Sets the value at the given coordinate.
        * \param[in] x point x coordinate.
@@ -79,10 +80,21 @@ namespace Utils
        * \param[in] value depth value.
        *
        * NOTE: this avoids race conditions between the get and set in GL triangle method that results in some invalid
-       *       pixels in the buffer due to OpenMP. In single thread execution get/set is enough.
+       *       pixels in the buffer due to OpenMP. It's implemented as an atomic compare-exchange loop on the value
+       *       so no update is lost and no lock is taken. In single thread execution get/set is enough.
        */
       bool checkAndSet(const unsigned short x, const unsigned short y, float value);
 
+      /** \brief Returns true if the given value is the one stored at the given coordinates and false
+       *  otherwise. The buffer is not modified.
+       * \param[in] x point x coordinate.
+       * \param[in] y point y coordinate.
+       * \param[in] value depth value.
+       *
+       */
+      bool checkEqual(const unsigned short x, const unsigned short y, float value) const
+      { return get(x, y) == value; }
+
       /** \brief Returns the width of the buffer.
        *
        */
@@ -93,12 +105,12 @@ namespace Utils
        */
       unsigned short getHeight() const;
 
-      /** \brief Returns the minimum value in the buffer.
+      /** \brief Returns the minimum value in the buffer. Computed on demand, cleared pixels are ignored.
        *
        */
       float getMinimum() const;
 
-      /** \brief Returns the maximum value in the buffer.
+      /** \brief Returns the maximum value in the buffer. Computed on demand.
        *
        */
       float getMaximum() const;
@@ -113,20 +125,135 @@ namespace Utils
        */
       void clear();
 
-      /** \brief Returns the data buffer pointer. Used to access data without mutex.
+      /** \brief Returns the data buffer pointer. Used to access data directly in read-only passes.
        *
        */
       const float *getBuffer() const
       { return m_data; }
 
+      /** \brief Returns the data buffer pointer for writing. The values can only be increased, like
+       *  checkAndSet() does, and the caller must make sure no other thread writes the same pixels.
+       *
+       */
+      float *getBuffer()
+      { return m_data; }
+
+      /** \brief Builds the hierarchical depth levels from the buffer contents. Each level keeps the
+       *  farthest depth of its cells, starting with blocks of BLOCK_SIZE pixels and halving the
+       *  resolution until a single cell covers the buffer.
+       *
+       */
+      void updateHierarchy();
+
+      /** \brief Returns true if every pixel of the given rectangle is closer than the given depth
+       *  according to the hierarchical levels, false otherwise or if the levels are outdated.
+       * \param[in] min rectangle minimum pixel coordinates.
+       * \param[in] max rectangle maximum pixel coordinates, inclusive.
+       * \param[in] depth depth of the nearest point of the rectangle contents.
+       *
+       * NOTE: the levels are conservative while depth values only increase, so checkAndSet() can be
+       *       used after updateHierarchy() but set() and clear() invalidate them.
+       */
+      bool isOccluded(const Vector2i &min, const Vector2i &max, const float depth) const;
+
+      static const unsigned short BLOCK_SIZE = 8; /** side of the hierarchy first level cells in pixels. */
+
     private:
       short      m_width;  /** buffer width.         */
       short      m_height; /** buffer height.        */
       float     *m_data;   /** buffer data.          */
-      float      m_min;    /** buffer minimum value. */
-      float      m_max;    /** buffer maximum value. */
 
-      mutable std::mutex m_mutex;  /** protects data */
+      std::vector<std::vector<float>> m_levels; /** hierarchy levels, farthest depth per cell. */
+      bool                            m_hValid; /** true if the hierarchy matches the buffer.  */
+
+      /** \brief Returns the width of the given hierarchy level.
+       * \param[in] level hierarchy level.
+       *
+       */
+      unsigned int levelWidth(const unsigned int level) const
+      { return (m_width + (BLOCK_SIZE << level) - 1) / (BLOCK_SIZE << level); }
+
+      /** \brief Returns the height of the given hierarchy level.
+       * \param[in] level hierarchy level.
+       *
+       */
+      unsigned int levelHeight(const unsigned int level) const
+      { return (m_height + (BLOCK_SIZE << level) - 1) / (BLOCK_SIZE << level); }
+
+      /** \brief Computes the minimum and maximum values of the buffer with a parallel reduction. The
+       *  limits are not tracked on every write to keep the depth test free of shared state.
+       * \param[out] min buffer minimum value.
+       * \param[out] max buffer maximum value.
+       *
+       */
+      void limits(float &min, float &max) const;
+  };
+
+  /** \class VisibilityBuffer
+   * \brief Stores the triangle visible in each pixel to defer its shading.
+   *
+   */
+  class VisibilityBuffer
+  {
+    public:
+      /** \struct Sample
+       * \brief Visible fragment of a pixel.
+       *
+       */
+      struct Sample
+      {
+        unsigned int   face;           /** face index in the mesh.                                        */
+        unsigned short mesh;           /** mesh index, EMPTY if no triangle covers the pixel.             */
+        float          barycentric[2]; /** second and third perspective correct barycentric coordinates. */
+      };
+
+      static const unsigned short EMPTY = 0xFFFF; /** mesh index of the pixels without fragment. */
+
+      /** \brief VisibilityBuffer class constructor.
+       * \param[in] width buffer width.
+       * \param[in] height buffer height.
+       *
+       */
+      VisibilityBuffer(const short width, const short height);
+
+      /** \brief Returns the sample at the given coordinates.
+       * \param[in] x point x coordinate.
+       * \param[in] y point y coordinate.
+       *
+       */
+      const Sample &get(const unsigned short x, const unsigned short y) const;
+
+      /** \brief Sets the sample at the given coordinates.
+       * \param[in] x point x coordinate.
+       * \param[in] y point y coordinate.
+       * \param[in] mesh mesh index.
+       * \param[in] face face index in the mesh.
+       * \param[in] barycentric perspective correct barycentric coordinates of the fragment.
+       *
+       */
+      void set(const unsigned short x, const unsigned short y, const unsigned short mesh, const unsigned int face, const Vector3f &barycentric);
+
+      /** \brief Returns the width of the buffer.
+       *
+       */
+      unsigned short getWidth() const
+      { return m_width; }
+
+      /** \brief Returns the height of the buffer.
+       *
+       */
+      unsigned short getHeight() const
+      { return m_height; }
+
+      /** \brief Clears the buffer.
+       *
+       */
+      void clear();
+
+    private:
+      short               m_width;  /** buffer width.  */
+      short               m_height; /** buffer height. */
+      std::vector<Sample> m_data;   /** buffer data.   */
   };
 
   /** \brief Draws the driangles onto the texture and saves it to disk.
@@ -0,0 +1,386 @@
+/*
+ File: Benchmark.cpp
+ Created on: 16 oct. 2026
+ Author: Felix de las Pozas Alvarez
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Project
+#include <Algebra.h>
+#include <GL_Impl.h>
+#include <Images.h>
+#include <Mesh.h>
+#include <Shaders.h>
+#include <Utils.h>
+
+// C++
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+Matrix4f ModelView;
+Matrix4f ViewPort;
+Matrix4f Projection;
+Vector3f Light;
+
+std::atomic<unsigned long> allocations{0};
+
+//--------------------------------------------------------------------
+void *operator new(std::size_t size)
+{
+  ++allocations;
+
+  if(auto pointer = std::malloc(size == 0 ? 1 : size)) return pointer;
+
+  throw std::bad_alloc();
+}
+
+//--------------------------------------------------------------------
+void operator delete(void *pointer) noexcept
+{
+  std::free(pointer);
+}
+
+//--------------------------------------------------------------------
+/** \struct NormalShader
+ * \brief Interpolates the normals of the triangle and computes the diffuse light, the usual work of a
+ *  fragment shader with Vector and Matrix temporaries.
+ *
+ */
+struct NormalShader
+: public GL_Impl::Shader
+{
+    virtual Vector4f vertex(int iface, int nthvert)
+    { return Vector4f{0, 0, 0, 1}; }
+
+    virtual bool fragment(Vector3f bar, Images::Color &color)
+    {
+      const auto n         = (varying_normals * bar).normalize();
+      const float diffuse  = std::max(0.f, n * uniform_light);
+      const auto intensity = static_cast<unsigned char>(255 * diffuse);
+
+      color = Images::Color(intensity, intensity, intensity);
+      ++fragments;
+
+      return false;
+    }
+
+    Matrix3f      varying_normals;  // normals of the triangle, a vertex per column.
+    Vector3f      uniform_light;    // light direction.
+    unsigned long fragments = 0;    // number of fragments shaded.
+};
+
+//--------------------------------------------------------------------
+/** \brief Draws random triangles with GL_Impl::triangle and reports the heap allocations per shaded
+ *  fragment and the triangles drawn per second.
+ * \param[in] triangles number of triangles to draw.
+ *
+ */
+void rasterization(const unsigned int triangles)
+{
+  const short width  = 800;
+  const short height = 800;
+
+  GL_Impl::viewport(0, 0, width, height);
+
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> position(-1.f, 1.f);
+  std::uniform_real_distribution<float> offset(-0.03f, 0.03f);
+
+  // triangles in normalized device coordinates, small as the faces of a model.
+  std::vector<Vector4f> points;
+  points.reserve(3 * triangles);
+  for(unsigned int i = 0; i < triangles; ++i)
+  {
+    const float x = position(generator);
+    const float y = position(generator);
+    const float z = position(generator);
+    for(int j = 0; j < 3; ++j)
+    {
+      points.push_back(Vector4f{x + offset(generator), y + offset(generator), z, 1.f});
+    }
+  }
+
+  Images::TGA image(width, height, Images::Image::RGB);
+  Utils::zBuffer buffer(width, height);
+
+  NormalShader shader;
+  shader.uniform_light = Vector3f{1, 1, 1}.normalize();
+  for(int j = 0; j < 3; ++j)
+  {
+    shader.varying_normals.setColumn(j, Vector3f{0.f, 0.5f * j, 1.f}.normalize());
+  }
+
+  const auto allocated = allocations.load();
+  const auto start     = std::chrono::high_resolution_clock::now();
+
+  for(unsigned int i = 0; i < triangles; ++i)
+  {
+    GL_Impl::triangle(&points[3 * i], shader, buffer, image);
+  }
+
+  const auto end  = std::chrono::high_resolution_clock::now();
+  const auto time = std::chrono::duration<double>(end - start).count();
+  const auto used = allocations.load() - allocated;
+
+  std::cout << "===== rasterization =====" << std::endl;
+  std::cout << "triangles: " << triangles << " fragments: " << shader.fragments << " time: " << time * 1000 << " ms" << std::endl;
+  std::cout << "triangles per second: " << triangles / time << std::endl;
+  std::cout << "allocations: " << used << " (" << static_cast<double>(used) / std::max(1ul, shader.fragments) << " per fragment)" << std::endl << std::flush;
+}
+
+//--------------------------------------------------------------------
+/** \brief Times the 3x3 and 4x4 inverses. The 3x3 one is the per fragment cost of the tangent basis of the
+ *  normal mapping shaders, inverse applied to the texture coordinate differences.
+ * \param[in] iterations number of inverses of each size.
+ *
+ */
+void inverse(const unsigned int iterations)
+{
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> value(-1.f, 1.f);
+
+  // diagonally dominant matrices, far from singular.
+  const unsigned int count = 1024;
+  std::vector<Matrix3f> matrices3(count);
+  std::vector<Matrix4f> matrices4(count);
+  std::vector<Vector3f> vectors(count);
+  for(unsigned int i = 0; i < count; ++i)
+  {
+    for(int j = 0; j < 4; ++j)
+    {
+      for(int k = 0; k < 4; ++k)
+      {
+        const float v = value(generator) + (j == k ? 4.f : 0.f);
+        if(j < 3 && k < 3) matrices3[i][j][k] = v;
+        matrices4[i][j][k] = v;
+      }
+      if(j < 3) vectors[i][j] = value(generator);
+    }
+  }
+
+  float sum = 0;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for(unsigned int i = 0; i < iterations; ++i)
+  {
+    const auto inverse = matrices3[i % count].inverse();
+    const auto tangent = inverse * vectors[i % count];
+    sum += tangent[0];
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  const auto time3 = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+
+  start = std::chrono::high_resolution_clock::now();
+  for(unsigned int i = 0; i < iterations; ++i)
+  {
+    sum += matrices4[i % count].inverse()[0][0];
+  }
+  end = std::chrono::high_resolution_clock::now();
+  const auto time4 = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+
+  std::cout << "===== inverse =====" << std::endl;
+  std::cout << "3x3 inverse and product (per fragment): " << time3 << " ns, 4x4 inverse: " << time4 << " ns (checksum " << sum << ")" << std::endl << std::flush;
+}
+
+//--------------------------------------------------------------------
+/** \brief Sets the viewport and the camera of the renderer.
+ * \param[in] width image width.
+ * \param[in] height image height.
+ *
+ */
+void camera(const short width, const short height)
+{
+  const Vector3f eye   {5,5,10};
+  const Vector3f center{0.,2.3,0.};
+
+  GL_Impl::viewport(width/8, height/8, width*3/4, height*3/4);
+  GL_Impl::projection(-1.f/(eye-center).norm());
+  GL_Impl::lookAt(eye, center, Vector3f{0,1,0});
+}
+
+//--------------------------------------------------------------------
+/** \brief Draws the faces of a wavefront obj model with the camera of the renderer and reports the
+ *  triangles drawn per second.
+ * \param[in] object model.
+ * \param[in] filename obj file name.
+ *
+ */
+void model(const Wavefront &object, const std::string &filename)
+{
+  const short width  = 1000;
+  const short height = 1000;
+
+  camera(width, height);
+
+  // clip coordinates and normals of the faces, computed before timing.
+  const auto transform = Projection*ModelView;
+  std::vector<Vector4f> points;
+  std::vector<Vector3f> normals;
+  for(auto mesh: object.meshes())
+  {
+    for(unsigned long i = 0; i < mesh->faces_num(); ++i)
+    {
+      Vector3f vertices[3];
+      for(int j = 0; j < 3; ++j)
+      {
+        vertices[j] = mesh->getVertex(mesh->getFaceVertexId(i, j));
+        points.push_back(transform * vertices[j].augment());
+      }
+      const Vector3f u = vertices[1] - vertices[0];
+      const Vector3f v = vertices[2] - vertices[0];
+      normals.push_back((u ^ v).normalize());
+    }
+  }
+
+  Images::TGA image(width, height, Images::Image::RGB);
+  Utils::zBuffer buffer(width, height);
+
+  NormalShader shader;
+  shader.uniform_light = Light.normalize();
+
+  const auto triangles = normals.size();
+  const auto start     = std::chrono::high_resolution_clock::now();
+
+  for(unsigned long i = 0; i < triangles; ++i)
+  {
+    for(int j = 0; j < 3; ++j)
+    {
+      shader.varying_normals.setColumn(j, normals[i]);
+    }
+
+    GL_Impl::triangle(&points[3 * i], shader, buffer, image);
+  }
+
+  const auto end  = std::chrono::high_resolution_clock::now();
+  const auto time = std::chrono::duration<double>(end - start).count();
+
+  std::cout << "===== model =====" << std::endl;
+  std::cout << filename << " triangles: " << triangles << " fragments: " << shader.fragments << " time: " << time * 1000 << " ms" << std::endl;
+  std::cout << "triangles per second: " << triangles / time << std::endl << std::flush;
+}
+
+//--------------------------------------------------------------------
+/** \brief Times the z-buffer and render passes of the renderer drawn calling the shaders through the
+ *  Shader interface and with the shader type known at compile time, and the depth-only z-buffer pass.
+ *  The render pass needs the diffuse textures of the model and is skipped without them.
+ * \param[in] object model.
+ * \param[in] repetitions number of draws of each pass.
+ *
+ */
+void dispatch(const Wavefront &object, const unsigned int repetitions)
+{
+  const short width  = 1000;
+  const short height = 1000;
+
+  camera(width, height);
+
+  const auto meshes    = object.meshes();
+  const auto backFaces = GL_Impl::CULL_FACE::CLOCKWISE;
+
+  auto depthShader = []()
+  {
+    return std::unique_ptr<EmptyShader>(new EmptyShader());
+  };
+
+  Utils::zBuffer depth(width, height);
+  Images::TGA image(width, height, Images::Image::RGB);
+
+  auto time = [&](const std::function<void()> &pass)
+  {
+    const auto start = std::chrono::high_resolution_clock::now();
+    for(unsigned int i = 0; i < repetitions; ++i) pass();
+    const auto end = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count() / repetitions;
+  };
+
+  const auto emptyVirtual = time([&]() { depth.clear(); GL_Impl::draw(meshes, GL_Impl::ShaderFactory(depthShader), depth, image, GL_Impl::DEPTH_TEST::CLOSER, backFaces); });
+  const auto emptyStatic  = time([&]() { depth.clear(); GL_Impl::draw<EmptyShader>(meshes, depthShader, depth, image, GL_Impl::DEPTH_TEST::CLOSER, backFaces); });
+  const auto depthOnly    = time([&]() { depth.clear(); GL_Impl::drawDepth(meshes, depthShader, depth, backFaces); });
+
+  bool textured = true;
+  for(auto mesh: meshes) textured &= mesh->hasDiffuse();
+
+  double finalVirtual = 0, finalStatic = 0;
+  if(textured)
+  {
+    // the camera depth buffer is used as the light one, the EQUAL depth test doesn't modify it.
+    auto ambient = std::make_shared<Images::TGA>(width, height, Images::Image::GRAYSCALE);
+    auto shadows = std::make_shared<Utils::zBuffer>(depth);
+    const auto shadowTransform = ViewPort*Projection*ModelView;
+
+    auto createFinalShader = [&]()
+    {
+      auto shader = new FinalShader();
+      shader->uniform_transform_S   = shadowTransform;
+      shader->uniform_ambient_image = ambient;
+      shader->uniform_depthBuffer   = shadows;
+
+      return std::unique_ptr<FinalShader>(shader);
+    };
+
+    auto finalShader = [&]()
+    {
+      return std::unique_ptr<GL_Impl::Shader>(createFinalShader());
+    };
+
+    finalVirtual = time([&]() { GL_Impl::draw(meshes, finalShader, depth, image, GL_Impl::DEPTH_TEST::EQUAL, backFaces); });
+    finalStatic  = time([&]() { GL_Impl::draw<FinalShader>(meshes, createFinalShader, depth, image, GL_Impl::DEPTH_TEST::EQUAL, backFaces); });
+  }
+
+  std::cout << "===== shader dispatch =====" << std::endl;
+  std::cout << "EmptyShader virtual: " << emptyVirtual << " ms static: " << emptyStatic << " ms depth only: " << depthOnly << " ms" << std::endl;
+  if(textured)
+  {
+    std::cout << "FinalShader virtual: " << finalVirtual << " ms static: " << finalStatic << " ms" << std::endl;
+  }
+  else
+  {
+    std::cout << "FinalShader skipped, the model has no diffuse textures." << std::endl;
+  }
+  std::cout << std::flush;
+}
+
+//--------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  Light = Vector3f{-5.,10.,3.};
+
+  rasterization(20000);
+  if(argc > 1)
+  {
+    const std::string filename = argv[1];
+    auto object = Wavefront::read(filename, true);
+    if(object && !object->meshes().empty())
+    {
+      model(*object, filename);
+      dispatch(*object, 5);
+    }
+    else
+    {
+      std::cout << "unable to read " << filename << ", model benchmarks skipped." << std::endl << std::flush;
+    }
+  }
+  inverse(1000000);
+
+  return 0;
+}
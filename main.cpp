@@ -23,6 +23,7 @@
 #include <Utils.h>
 #include <Algebra.h>
 #include <Shaders.h>
+#include <Deferred.h>
 
 // C++
 #include <array>
@@ -46,12 +47,109 @@ constexpr auto PI   = 3.14159265358979323846;
 constexpr auto PI_2 = 1.57079632679489661923;
 constexpr auto PI_4 = 0.78539816339744830962;
 
+//--------------------------------------------------------------------
+/** \brief Compares the image with the reference one and prints the result. The barycentric coordinates
+ *  stored in the visibility buffer can move a texture lookup to the neighbour texel, so a few pixels can
+ *  differ, by a large amount on texture edges. Returns true if at most one pixel in a thousand differs.
+ * \param[in] reference reference image.
+ * \param[in] image image to compare.
+ * \param[in] name name of the image in the output.
+ *
+ */
+bool compare(Image &reference, Image &image, const std::string &name)
+{
+  const int width  = reference.getWidth();
+  const int height = reference.getHeight();
+
+  int pixels = 0, maxDelta = 0;
+  for(int y = 0; y < height; ++y)
+  {
+    for(int x = 0; x < width; ++x)
+    {
+      const auto a = reference.get(x, y);
+      const auto b = image.get(x, y);
+
+      int delta = 0;
+      for(int i = 0; i < 3; ++i) delta = std::max(delta, std::abs(a.raw[i] - b.raw[i]));
+
+      if(delta != 0) ++pixels;
+      maxDelta = std::max(maxDelta, delta);
+    }
+  }
+
+  const bool matches = (pixels <= width * height / 1000);
+  std::cout << name << " differs from forward in " << pixels << " pixels, max delta " << maxDelta << (matches ? ", OK." : ", MISMATCH.") << std::endl;
+
+  return matches;
+}
+
+//--------------------------------------------------------------------
+/** \brief Draws the render pass with the forward, visibility buffer and deferred paths and compares the
+ *  last two with the forward one. Returns 0 if both match and 1 otherwise.
+ * \param[in] meshes meshes to draw.
+ * \param[in] depthShader shader factory of the depth passes.
+ * \param[in] finalShader shader factory of the render pass.
+ * \param[in] buffer z-buffer of the depth pass, isn't modified.
+ * \param[in] cull faces culled in the depth pass.
+ *
+ */
+int check(const std::vector<std::shared_ptr<Mesh>> &meshes, const ShaderFactory &depthShader,
+          const Deferred::FinalShaderFactory &finalShader, Utils::zBuffer &buffer, const CULL_FACE cull)
+{
+  std::cout << "===== forward/visibility/deferred check =====" << std::endl << std::flush;
+  const auto width  = buffer.getWidth();
+  const auto height = buffer.getHeight();
+
+  auto shaderFactory = [&]()
+  {
+    return std::unique_ptr<Shader>(finalShader());
+  };
+
+  TGA forwardImage(width, height, Image::RGB);
+  TGA visibilityImage(width, height, Image::RGB);
+  TGA deferredImage(width, height, Image::RGB);
+
+  draw<FinalShader>(meshes, finalShader, buffer, forwardImage, DEPTH_TEST::EQUAL, cull);
+
+  VisibilityBuffer visibility(width, height);
+  drawVisibility(meshes, depthShader, buffer, visibility, DEPTH_TEST::EQUAL, cull);
+  shade(meshes, shaderFactory, visibility, visibilityImage);
+
+  Deferred::GBuffer gbuffer(width, height);
+  Deferred::geometry(meshes, finalShader, visibility, gbuffer);
+  Deferred::shadows(finalShader, gbuffer);
+  Deferred::lighting(meshes, finalShader, gbuffer, deferredImage);
+
+  const bool visibilityMatches = compare(forwardImage, visibilityImage, "visibility");
+  const bool deferredMatches   = compare(forwardImage, deferredImage, "deferred");
+  std::cout << std::flush;
+
+  return (visibilityMatches && deferredMatches) ? 0 : 1;
+}
+
 //--------------------------------------------------------------------
 int main(int argc, char *argv[])
 {
   auto threadsNum  = std::thread::hardware_concurrency();
   short int width  = 1000;
   short int height = 1000;
+
+  // shades the render pass from a visibility buffer or a G-buffer instead of during the rasterization.
+  // The faces of the model can be reordered for vertex cache locality, the result is saved next to the model.
+  // The check option compares the render pass of the visibility buffer and deferred paths with the forward
+  // one and returns non-zero if they don't match.
+  bool useVisibility = false;
+  bool useDeferred   = false;
+  bool optimize      = false;
+  bool useCheck      = false;
+  for(int i = 1; i < argc; ++i)
+  {
+    const std::string option = argv[i];
+    useVisibility |= (option == "--visibility");
+    useDeferred   |= (option == "--deferred");
+    optimize      |= (option == "--optimize");
+    useCheck      |= (option == "--check");
+  }
   Vector3f eye   {5,5,10};
   Vector3f center{0.,2.3,0.};
   Vector3f up    {0,1,0};
@@ -69,28 +167,26 @@ int main(int argc, char *argv[])
 
   BlockTimer timer("Render");
 
-  auto object = Wavefront::read("obj/TF2-Engineer/Engineer.obj");
+  auto object = Wavefront::read("obj/TF2-Engineer/Engineer.obj", true);
 
-  // z-buffer generation pass
-  std::cout << "===== z-buffer pass =====" << std::endl << std::flush;
-  for(auto mesh: object->meshes())
+  if(optimize)
   {
-    std::cout << "process " << mesh->id() << std::endl << std::flush;
-    #pragma omp parallel for schedule(dynamic,1) num_threads(threadsNum)
-    for (unsigned long i = 0; i < mesh->faces_num(); i++)
-    {
-      EmptyShader shader;
-      shader.uniform_mesh = mesh;
+    object->optimize();
+    object->write("obj/TF2-Engineer/Engineer_optimized.obj");
+  }
 
-      Vector4f screen_coords[3];
-      for (int j = 0; j < 3; j++)
-      {
-        screen_coords[j] = shader.vertex(i, j);
-      }
+  // the same faces must be culled in every pass drawn with the camera for the EQUAL depth test.
+  const auto backFaces = CULL_FACE::CLOCKWISE;
 
-      triangle(screen_coords, shader, *zBuffer, *image);
-    }
-  }
+  auto depthShader = []()
+  {
+    auto shader = new EmptyShader();
+    return std::unique_ptr<EmptyShader>(shader);
+  };
+
+  // z-buffer generation pass
+  std::cout << "===== z-buffer pass =====" << std::endl << std::flush;
+  drawDepth(object->meshes(), depthShader, *zBuffer, backFaces);
 
   zBuffer->write("1-zBufferPass");
 
@@ -98,7 +194,7 @@ int main(int argc, char *argv[])
   std::cout << "===== ambient occlusion pass =====" << std::endl;
   std::cout << "using " << (static_cast<bool>(__builtin_cpu_supports("avx")) ? "avx" : "standard") << " method." << std::endl << std::flush;
   auto ambientImage = std::make_shared<TGA>(width, height, Image::GRAYSCALE);
-  auto zPtr = zBuffer->getBuffer(); // only reads, we can bypass mutex to execute faster.
+  auto zPtr = zBuffer->getBuffer(); // only reads, we can access the buffer directly.
 
   #pragma omp parallel for schedule(dynamic,1) num_threads(threadsNum)
   for (int x = 0; x < width; x++)
@@ -124,7 +220,6 @@ int main(int argc, char *argv[])
   ambientImage->write("2-ambient");
 //  auto ambientImage = Images::TGA::read("2-ambient.tga");
   ambientImage->flipVertically();
-  zBuffer->clear();
 
   auto dBuffer = std::make_shared<Utils::zBuffer>(width, height);
 
@@ -133,24 +228,7 @@ int main(int argc, char *argv[])
   lookAt(lightVector, center, up);
 
   std::cout << "===== light depth pass =====" << std::endl << std::flush;
-  for(auto mesh: object->meshes())
-  {
-    std::cout << "process " << mesh->id() << std::endl << std::flush;
-    #pragma omp parallel for schedule(dynamic,1) num_threads(threadsNum)
-    for (unsigned long i = 0; i < mesh->faces_num(); i++)
-    {
-      EmptyShader shader;
-      shader.uniform_mesh = mesh;
-
-      Vector4f screen_coords[3];
-      for (int j = 0; j < 3; j++)
-      {
-        screen_coords[j] = shader.vertex(i, j);
-      }
-
-      triangle(screen_coords, shader, *dBuffer, *image);
-    }
-  }
+  drawDepth(object->meshes(), depthShader, *dBuffer, backFaces);
 
   dBuffer->write("3-depthPass");
 
@@ -159,38 +237,53 @@ int main(int argc, char *argv[])
   projection(-1.f/(eye-center).norm());
   lookAt(eye, center, up);
 
-  // int pass = 0;
-  std::cout << "===== render pass =====" << std::endl << std::flush;
-  for(auto mesh: object->meshes())
+  // the uniforms are set once for the pass, every rendering thread gets a copy.
+  FinalShader finalUniforms;
+  finalUniforms.uniform_transform_S = ShadowTransform;
+  finalUniforms.uniform_ambient_image = ambientImage;
+  finalUniforms.uniform_depthBuffer = dBuffer;
+  finalUniforms.uniform_glow_coeff = 2.5;
+
+  auto createFinalShader = [&]()
   {
-    std::cout << "process " << mesh->id() << std::endl << std::flush;
-    #pragma omp parallel for schedule(dynamic,1) num_threads(threadsNum)
-    for (unsigned long i = 0; i < mesh->faces_num(); i++)
-    {
-      FinalShader shader;
-      shader.uniform_transform_S = ShadowTransform;
-      shader.uniform_ambient_image = ambientImage;
-      shader.uniform_depthBuffer = dBuffer;
-      shader.uniform_mesh = mesh;
-      shader.uniform_glow_coeff = 2.5;
-
-      Vector4f screen_coords[3];
-      for (int j = 0; j < 3; j++)
-      {
-        screen_coords[j] = shader.vertex(i, j);
-      }
+    return std::unique_ptr<FinalShader>(new FinalShader(finalUniforms));
+  };
 
-      triangle(screen_coords, shader, *zBuffer, *image);
-    }
+  auto finalShader = [&]()
+  {
+    return std::unique_ptr<Shader>(createFinalShader());
+  };
+
+  // the z-buffer of the first pass is kept so only the visible fragment of each pixel is shaded.
+  std::cout << "===== render pass =====" << std::endl << std::flush;
+  if(useVisibility)
+  {
+    VisibilityBuffer visibility(width, height);
+    drawVisibility(object->meshes(), depthShader, *zBuffer, visibility, DEPTH_TEST::EQUAL, backFaces);
+    shade(object->meshes(), finalShader, visibility, *image);
+  }
+  else if(useDeferred)
+  {
+    VisibilityBuffer visibility(width, height);
+    drawVisibility(object->meshes(), depthShader, *zBuffer, visibility, DEPTH_TEST::EQUAL, backFaces);
 
-    // write the image after a mesh has been drawn.
-    // image->write("pass_" + std::to_string(++pass));
-    // dump texture decomposition in triangles.
-    // dumpTexture(current, "pass_text_" + std::to_string(pass));
+    Deferred::GBuffer gbuffer(width, height);
+    Deferred::geometry(object->meshes(), createFinalShader, visibility, gbuffer);
+    Deferred::shadows(createFinalShader, gbuffer);
+    Deferred::lighting(object->meshes(), createFinalShader, gbuffer, *image);
+  }
+  else
+  {
+    draw<FinalShader>(object->meshes(), createFinalShader, *zBuffer, *image, DEPTH_TEST::EQUAL, backFaces);
   }
 
   image->flipVertically(); // i want to have the origin at the left bottom corner of the image
   image->write("4-output");
 
+  if(useCheck)
+  {
+    return check(object->meshes(), depthShader, createFinalShader, *zBuffer, backFaces);
+  }
+
 	return 0;
 }
@@ -0,0 +1,127 @@
+/*
+ File: AlgebraTest.cpp
+ Created on: 16 oct. 2026
+ Author: Felix de las Pozas Alvarez
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Project
+#include <Algebra.h>
+
+// C++
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+
+// Compares the 4-wide float kernels of Algebra.h (SSE when available) with the generic templates,
+// called explicitly, or with the plain scalar computation. Also checks that integer vectors scaled by
+// a floating point value are computed in the scalar type. Returns the number of failed checks.
+
+unsigned int failures = 0;
+
+//--------------------------------------------------------------------
+/** \brief Checks that the given values are equal up to a relative tolerance, prints the failure.
+ * \param[in] name check name.
+ * \param[in] value computed value.
+ * \param[in] expected expected value.
+ *
+ */
+void check(const std::string &name, const float value, const float expected)
+{
+  const float tolerance = 1e-5f * std::max(1.f, std::abs(expected));
+  if(!(std::abs(value - expected) <= tolerance))
+  {
+    std::cout << "FAILED " << name << ": " << value << " expected " << expected << std::endl;
+    ++failures;
+  }
+}
+
+//--------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> value(-10.f, 10.f);
+
+  const int iterations = 1000;
+  for(int i = 0; i < iterations; ++i)
+  {
+    Vector4f a, b;
+    Vector3f c, d;
+    Matrix4f m, n;
+    for(int j = 0; j < 4; ++j)
+    {
+      a[j] = value(generator);
+      b[j] = value(generator);
+      if(j < 3)
+      {
+        c[j] = value(generator);
+        d[j] = value(generator);
+      }
+      for(int k = 0; k < 4; ++k)
+      {
+        m[j][k] = value(generator);
+        n[j][k] = value(generator);
+      }
+    }
+
+    // dot product.
+    float dot = 0;
+    for(int j = 0; j < 4; ++j) dot += a[j] * b[j];
+    check("dot", a * b, dot);
+
+    // normalize.
+    const float norm = std::sqrt(a[0]*a[0] + a[1]*a[1] + a[2]*a[2] + a[3]*a[3]);
+    Vector4f normalized = a;
+    normalized.normalize();
+    for(int j = 0; j < 4; ++j) check("normalize", normalized[j], a[j] / norm);
+
+    // cross product.
+    const auto cross = c ^ d;
+    check("cross", cross[0], c[1]*d[2] - c[2]*d[1]);
+    check("cross", cross[1], c[2]*d[0] - c[0]*d[2]);
+    check("cross", cross[2], c[0]*d[1] - c[1]*d[0]);
+
+    // matrix * vector.
+    const auto mv        = m * a;
+    const auto mvGeneric = operator*<float, 4, 4>(m, a);
+    for(int j = 0; j < 4; ++j) check("matrix * vector", mv[j], mvGeneric[j]);
+
+    // matrix * matrix.
+    const auto mm        = m * n;
+    const auto mmGeneric = operator*<float, 4, 4, 4>(m, n);
+    for(int j = 0; j < 4; ++j)
+    {
+      for(int k = 0; k < 4; ++k) check("matrix * matrix", mm[j][k], mmGeneric[j][k]);
+    }
+  }
+
+  // integer vector and floating point scalar.
+  const Vector2i v{3, 5};
+  const Vector2i scaled  = v * 0.5f;
+  const Vector2i divided = v / 0.5f;
+  Vector2i multiplied = v;
+  multiplied *= 1.5;
+  check("integer * scalar", scaled[0], 1);
+  check("integer * scalar", scaled[1], 2);
+  check("integer / scalar", divided[0], 6);
+  check("integer / scalar", divided[1], 10);
+  check("integer *= scalar", multiplied[0], 4);
+  check("integer *= scalar", multiplied[1], 7);
+
+  std::cout << "algebra: " << failures << " failures." << std::endl;
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+/*
+ File: zBufferTest.cpp
+ Created on: 16 oct. 2026
+ Author: Felix de las Pozas Alvarez
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Project
+#include <Algebra.h>
+#include <Utils.h>
+
+// C++
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+// OpenMP
+#include <omp.h>
+
+// Several threads call zBuffer::checkAndSet() on the same few pixels with known depths. The final buffer
+// must keep the closest (largest) depth of every pixel, the same as the sequential execution, and the
+// buffer limits must be the floor, kept by the last pixel, and the largest depth written.
+
+// transformations used by GL_Impl, linked with Utils.
+Matrix4f ModelView;
+Matrix4f ViewPort;
+Matrix4f Projection;
+Vector3f Light;
+
+//--------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  const short width       = 16;
+  const short height      = 16;
+  const int   pixels      = width * height;
+  const int   threads     = std::max(4, omp_get_max_threads());
+  const int   perThread   = 100000;
+  const float floor       = -1000.f;
+
+  // depths of every thread, in the range (floor, 1000).
+  std::vector<std::vector<float>> depths(threads, std::vector<float>(perThread));
+  for(int t = 0; t < threads; ++t)
+  {
+    std::mt19937 generator(42 + t);
+    std::uniform_real_distribution<float> value(-999.f, 1000.f);
+    for(auto &depth: depths[t]) depth = value(generator);
+  }
+
+  Utils::zBuffer parallel(width, height);
+  Utils::zBuffer sequential(width, height);
+
+  // the floor is written first to every pixel and the last one is not written again, so the buffer
+  // minimum is known.
+  for(int i = 0; i < pixels; ++i)
+  {
+    parallel.checkAndSet(i % width, i / width, floor);
+    sequential.checkAndSet(i % width, i / width, floor);
+  }
+
+  #pragma omp parallel num_threads(threads)
+  {
+    const int t = omp_get_thread_num();
+    for(int i = 0; i < perThread; ++i)
+    {
+      const int pixel = (i * 7 + t) % (pixels - 1);
+      parallel.checkAndSet(pixel % width, pixel / width, depths[t][i]);
+    }
+  }
+
+  std::vector<float> expected(pixels, floor);
+  float maximum = floor;
+  for(int t = 0; t < threads; ++t)
+  {
+    for(int i = 0; i < perThread; ++i)
+    {
+      const int pixel = (i * 7 + t) % (pixels - 1);
+      sequential.checkAndSet(pixel % width, pixel / width, depths[t][i]);
+      expected[pixel] = std::max(expected[pixel], depths[t][i]);
+      maximum         = std::max(maximum, depths[t][i]);
+    }
+  }
+
+  unsigned int failures = 0;
+  for(int i = 0; i < pixels; ++i)
+  {
+    const auto value = parallel.get(i % width, i / width);
+    if(value != expected[i] || value != sequential.get(i % width, i / width))
+    {
+      std::cout << "FAILED pixel " << i % width << "," << i / width << ": " << value << " expected " << expected[i] << std::endl;
+      ++failures;
+    }
+  }
+
+  if(parallel.getMinimum() != floor || parallel.getMinimum() != sequential.getMinimum())
+  {
+    std::cout << "FAILED minimum: " << parallel.getMinimum() << " expected " << floor << std::endl;
+    ++failures;
+  }
+
+  if(parallel.getMaximum() != maximum || parallel.getMaximum() != sequential.getMaximum())
+  {
+    std::cout << "FAILED maximum: " << parallel.getMaximum() << " expected " << maximum << std::endl;
+    ++failures;
+  }
+
+  std::cout << "zBuffer: " << threads << " threads, " << failures << " failures." << std::endl;
+
+  return failures == 0 ? 0 : 1;
+}